@@ -0,0 +1,142 @@
+#ifndef __BENCH_COMMON_H__
+#define __BENCH_COMMON_H__
+
+/*
+ * Schedule, sample and percentile helpers shared by the key benchmarks in
+ * input/test and button/test. Each tool is a single translation unit, so
+ * everything here is static.
+ *
+ * A pattern is a list of actions, each driving one gpio-mockup line at a
+ * time relative to the start of the pattern. Actions that should produce an
+ * event push their timestamp on a per-key pending ring; the consumer pops
+ * it when the event arrives and adds the difference to a samples_t.
+ * report_samples() prints the count, p50/p90/p99 and max of a sample set as
+ * "key value" lines.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+#define BENCH_MAX_KEYS          16
+#define BENCH_MAX_PENDING       4096
+#define BENCH_MAX_SAMPLES       (1 << 20)
+
+typedef enum {
+    EXPECT_NONE = 0,
+    EXPECT_PRESS,
+    EXPECT_RELEASE,
+} expect_t;
+
+typedef struct {
+    long long at;               /* ns after start of the pattern */
+    int key;
+    int level;
+    expect_t expect;
+} action_t;
+
+typedef struct {
+    long long t[BENCH_MAX_PENDING];
+    unsigned int head, tail;
+} pending_t;
+
+typedef struct {
+    long long* v;
+    size_t n;
+} samples_t;
+
+static action_t* actions = NULL;
+static size_t actions_num = 0, actions_max = 0;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void add_action(long long at, int key, int level, expect_t expect)
+{
+    if (actions_num == actions_max)
+    {
+        actions_max = actions_max ? actions_max * 2 : 1024;
+        actions = realloc(actions, actions_max * sizeof(*actions));
+        if (!actions)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    actions[actions_num].at = at;
+    actions[actions_num].key = key;
+    actions[actions_num].level = level;
+    actions[actions_num].expect = expect;
+    actions_num++;
+}
+
+/* the oldest timestamp is overwritten once BENCH_MAX_PENDING are waiting */
+static void pending_push(pending_t* p, long long t)
+{
+    p->t[p->head++ % BENCH_MAX_PENDING] = t;
+    if (p->head - p->tail > BENCH_MAX_PENDING)
+        p->tail++;
+}
+
+static int pending_pop(pending_t* p, long long* t)
+{
+    if (p->head == p->tail)
+        return -1;
+    *t = p->t[p->tail++ % BENCH_MAX_PENDING];
+    return 0;
+}
+
+static void pending_reset(pending_t* p)
+{
+    p->head = p->tail = 0;
+}
+
+static void sample_add(samples_t* s, long long v)
+{
+    if (s->n < BENCH_MAX_SAMPLES)
+        s->v[s->n++] = v;
+}
+
+static int cmp_ll(const void* a, const void* b)
+{
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Print "<prefix><pattern>.<name>.*" lines; sorts the samples. */
+static void report_samples(const char* prefix, const char* pattern, const char* name, samples_t* s)
+{
+    static const int pct[] = {50, 90, 99};
+    int i = 0;
+
+    printf("%s%s.%s.count %zu\n", prefix, pattern, name, s->n);
+    if (!s->n)
+        return;
+    qsort(s->v, s->n, sizeof(s->v[0]), cmp_ll);
+    for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+    {
+        printf("%s%s.%s.p%d_us %.1f\n", prefix, pattern, name, pct[i],
+               s->v[(s->n - 1) * pct[i] / 100] / 1000.0);
+    }
+    printf("%s%s.%s.max_us %.1f\n", prefix, pattern, name, s->v[s->n - 1] / 1000.0);
+}
+
+/* Drive a gpio-mockup line through its debugfs pull file. */
+static int set_mockup_line(int fd, int level)
+{
+    const char* val = level ? "1" : "0";
+    if (pwrite(fd, val, 1, 0) != 1)
+    {
+        perror("gpio-mockup write");
+        return -1;
+    }
+    return 0;
+}
+
+#endif /* __BENCH_COMMON_H__ */
@@ -0,0 +1,175 @@
+#!/bin/sh
+#
+# Host benchmark suite for the led and button drivers.
+#
+# The i.MX28 pins are replaced by gpio-mockup lines (needs CONFIG_GPIO_MOCKUP,
+# CONFIG_GPIO_SYSFS and debugfs). Build first with `make` in this directory,
+# then run as root. Every result is printed as one "key value" line on stdout;
+# keys are stable across runs so two outputs can be diffed or compared by a
+# script. Diagnostics go to stderr.
+#
+#   lines 0-4    input/button.ko keys
+#   lines 5-9    button/button.ko buttons
+#   lines 10-13  led/led.ko LEDs
+#
+# Environment: SECONDS_PER_RUN (default 5), ITERATIONS (default 200).
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+TOP=$(dirname "$BENCH_DIR")
+RUN_SECONDS=${SECONDS_PER_RUN:-5}
+ITERATIONS=${ITERATIONS:-200}
+
+die()
+{
+    echo "$*" >&2
+    exit 1
+}
+
+[ "$(id -u)" -eq 0 ] || die "run.sh must be run as root"
+
+mountpoint -q /sys/kernel/debug || mount -t debugfs none /sys/kernel/debug
+modprobe -r gpio-mockup 2>/dev/null || true
+modprobe gpio-mockup gpio_mockup_ranges=-1,16 || die "gpio-mockup not available"
+
+BASE=
+MOCKUP=
+for chip in /sys/class/gpio/gpiochip*; do
+    if [ "$(cat "$chip/label")" = "gpio-mockup-A" ]; then
+        BASE=$(cat "$chip/base")
+        MOCKUP=/sys/kernel/debug/gpio-mockup/$(basename "$(readlink -f "$chip/device")")
+    fi
+done
+[ -n "$BASE" ] && [ -d "$MOCKUP" ] || die "gpio-mockup chip not found"
+
+# gpio list "first count" -> "base+first,..."
+gpios()
+{
+    i=0
+    list=
+    while [ $i -lt "$2" ]; do
+        list="$list${list:+,}$((BASE + $1 + i))"
+        i=$((i + 1))
+    done
+    echo "$list"
+}
+
+# line list "first count" -> "first,..."
+lines()
+{
+    i=0
+    list=
+    while [ $i -lt "$2" ]; do
+        list="$list${list:+,}$(($1 + i))"
+        i=$((i + 1))
+    done
+    echo "$list"
+}
+
+# drive mockup lines "first count level"
+set_lines()
+{
+    for l in $(lines "$1" "$2" | tr ',' ' '); do
+        echo "$3" > "$MOCKUP/$l"
+    done
+}
+
+# create /dev/$1 for the chrdev registered under that name
+make_node()
+{
+    major=$(awk -v name="$1" '$2 == name { print $1 }' /proc/devices)
+    [ -n "$major" ] || die "$1 not in /proc/devices"
+    rm -f "/dev/$1"
+    mknod "/dev/$1" c "$major" 0
+}
+
+# cpu utilisation, interrupts and context switches per second, from
+# /proc/stat deltas over RUN_SECONDS, printed under the prefix "$1"
+measure_cpu()
+{
+    set -- "$1" $(awk '/^cpu / { t = 0; for (i = 2; i <= NF; i++) t += $i; print t, $5 + $6 }
+                       /^intr / { print $2 } /^ctxt / { print $2 }' /proc/stat)
+    sleep "$RUN_SECONDS"
+    awk -v p="$1" -v t0="$2" -v i0="$3" -v n0="$4" -v c0="$5" -v s="$RUN_SECONDS" '
+        /^cpu / { t = 0; for (i = 2; i <= NF; i++) t += $i; idle = $5 + $6 }
+        /^intr / { n = $2 } /^ctxt / { c = $2 }
+        END {
+            dt = t - t0
+            printf "%s.cpu_busy_pct %.2f\n", p, dt ? 100 * (dt - (idle - i0)) / dt : 0
+            printf "%s.irqs_per_sec %.1f\n", p, (n - n0) / s
+            printf "%s.ctxt_per_sec %.1f\n", p, (c - c0) / s
+        }' /proc/stat
+}
+
+echo "bench.version 1"
+echo "bench.kernel $(uname -r)"
+echo "bench.seconds_per_run $RUN_SECONDS"
+echo "bench.iterations $ITERATIONS"
+
+measure_cpu baseline
+
+# LED toggle rate from userspace
+echo "led: toggling 4 LEDs" >&2
+insmod "$TOP/led/led.ko" gpios="$(gpios 10 4)"
+make_node led
+measure_cpu led.idle
+"$TOP/led/test/led_bench" -d /dev/led -t 1 -l 4 -s "$RUN_SECONDS"
+"$TOP/led/test/led_bench" -d /dev/led -t 1 -l 4 -s "$RUN_SECONDS" -w | sed 's/^led\.toggle\./led.frame./'
+rmmod led
+
+# imx-keys input driver: edge to evdev read latency and bursts
+echo "input: imx-keys on lines 0-4" >&2
+set_lines 0 5 1
+insmod "$TOP/input/button.ko" gpios="$(gpios 0 5)"
+sleep 1
+measure_cpu input.idle
+set_lines 0 5 0
+measure_cpu input.held
+set_lines 0 5 1
+sleep 1
+"$TOP/input/test/button_bench" -d "$MOCKUP" -l "$(lines 0 5)" -n "$ITERATIONS" | sed 's/^/input./'
+rmmod button
+
+# the same keys polled instead of interrupting; presses are held past the
+# idle poll interval so none is missed
+echo "input: imx-keys polled on lines 0-4" >&2
+insmod "$TOP/input/button.ko" gpios="$(gpios 0 5)" polled="$(lines 0 5)"
+sleep 1
+measure_cpu input_polled.idle
+"$TOP/input/test/button_bench" -d "$MOCKUP" -l "$(lines 0 5)" -n "$ITERATIONS" -p clean -h 250 |
+    sed 's/^/input_polled./'
+for input in /sys/class/input/input*; do
+    if [ "$(cat "$input/name")" = "imx-keys" ]; then
+        for stat in polls ns_total ns_max; do
+            echo "input_polled.poll.$stat $(cat "$input/poll/$stat")"
+        done
+    fi
+done
+rmmod button
+
+# /dev/button driver: edge to read latency and bursts
+echo "button: /dev/button on lines 5-9" >&2
+set_lines 5 5 1
+insmod "$TOP/button/button.ko" gpios="$(gpios 5 5)"
+make_node button
+measure_cpu button.idle
+set_lines 5 5 0
+measure_cpu button.held
+set_lines 5 5 1
+sleep 1
+"$TOP/button/test/button_bench" -d "$MOCKUP" -l "$(lines 5 5)" -n "$ITERATIONS"
+for rate in 1000 100000; do
+    "$TOP/button/test/button_bench" -p inject -r $rate -n $((ITERATIONS * 50)) |
+        sed "s/^button\.inject\./button.inject_$rate./"
+done
+"$TOP/button/test/button_bench" -p inject -r 1000 -n $((ITERATIONS * 50)) -m 16 -w 20 |
+    sed "s/^button\.inject\./button.inject_moderated./"
+
+# button press routed to an LED inside the kernel
+insmod "$TOP/led/led.ko" gpios="$(gpios 10 4)"
+"$TOP/button/test/button_bench" -d "$MOCKUP" -l "$(lines 5 5)" -n "$ITERATIONS" -p route -L 10
+rmmod button
+rmmod led
+
+modprobe -r gpio-mockup
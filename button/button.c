@@ -1,32 +1,63 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/slab.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/mutex.h>
 #include <linux/uaccess.h>
 #include <linux/gpio.h>
 #include <linux/irqreturn.h>
 #include <linux/interrupt.h>
 #include <linux/irq.h>
-#include "../arch/arm/mach-mx28/mx28_pins.h"
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/capability.h>
+#include "imx28_compat.h"
+#include "imx28_log.h"
+#include "button_ioctl.h"
+#include "../led/led_route.h"
+#include "../fm24cxx/fm24_kernel.h"
+#define CREATE_TRACE_POINTS
+#include "button_trace.h"
 
 
 #define BUTTON_DEV_MAJOR           0
 
 #define BUTTON_DEV_NAME            "button"
+#ifdef CONFIG_ARCH_MX28
+#include "../arch/arm/mach-mx28/mx28_pins.h"
+
 #define BUTTON1_PIN                MXS_PIN_TO_GPIO(PINID_LCD_D17)
 #define BUTTON2_PIN                MXS_PIN_TO_GPIO(PINID_LCD_D18)
 #define BUTTON3_PIN                MXS_PIN_TO_GPIO(PINID_SSP0_DATA4)
 #define BUTTON4_PIN                MXS_PIN_TO_GPIO(PINID_SSP0_DATA5)
 #define BUTTON5_PIN                MXS_PIN_TO_GPIO(PINID_SSP0_DATA6)
-
-#define BUTTON_BUFSZ               20
+#else
+/* no default pins off the board, they must be given with gpios= */
+#define BUTTON1_PIN                -1
+#define BUTTON2_PIN                -1
+#define BUTTON3_PIN                -1
+#define BUTTON4_PIN                -1
+#define BUTTON5_PIN                -1
+#endif
+
+#define BUTTON_BUFSZ               (BUTTON_QUEUE_LEN + 1)
+#define BUTTON_JOURNAL_BACKLOG     64
+/* presses one inject timer callback may catch up on, bounds its irq time */
+#define BUTTON_INJECT_BURST_MAX    16
 
 typedef struct {
     int index;
     const char* name;
-    unsigned long gpio;
+    int gpio;
     int irq;
 } imx_button_t;
 
@@ -39,7 +70,9 @@ typedef enum {
 
 static int button_dev_major = BUTTON_DEV_MAJOR;
 
-const imx_button_t imx_buttons[] = {
+IMX_LOG_DEFINE();
+
+imx_button_t imx_buttons[] = {
     {.index = 0, .name = "button1", .gpio = BUTTON1_PIN,},
     {.index = 1, .name = "button2", .gpio = BUTTON2_PIN,},
     {.index = 2, .name = "button3", .gpio = BUTTON3_PIN,},
@@ -48,10 +81,34 @@ const imx_button_t imx_buttons[] = {
 };
 #define IMX_BUTTON_NUM         (sizeof(imx_buttons)/sizeof(imx_buttons[0]))
 
+static int gpios[IMX_BUTTON_NUM];
+static int gpios_num = 0;
+module_param_array(gpios, int, &gpios_num, 0444);
+MODULE_PARM_DESC(gpios, "override the button gpio numbers, e.g. with gpio-mockup lines on a host");
+
+static unsigned int long_press_ms = 1000;
+module_param(long_press_ms, uint, 0644);
+MODULE_PARM_DESC(long_press_ms, "hold time of a long press for LED bindings, 0 disables long presses");
+
+static int journal_chip = -1;
+module_param(journal_chip, int, 0444);
+MODULE_PARM_DESC(journal_chip, "fm24 chip (minor) to journal button events to, -1 disables the journal");
+
+static unsigned int journal_base = 0;
+module_param(journal_base, uint, 0444);
+MODULE_PARM_DESC(journal_base, "start of the journal region in the chip");
+
+static unsigned int journal_size = 256;
+module_param(journal_size, uint, 0444);
+MODULE_PARM_DESC(journal_size, "bytes of the journal region, head included");
+
 typedef struct {
     button_status_t status;
     imx_button_t* imx_button;
     struct timer_list timer;
+    unsigned long pressed_at;
+    int long_sent;
+    int synthetic;
     void* private_data;
 } button_t;
 
@@ -60,57 +117,408 @@ typedef struct {
     button_t buttons[IMX_BUTTON_NUM];
     unsigned char buf[BUTTON_BUFSZ];
     unsigned int head, tail;
+    spinlock_t lock;
+    struct list_head readers;
+    button_stats_t stats;
+    struct mutex ctl_lock;
+    /* synthetic presses, debounced on a private set of button states */
+    struct hrtimer inject_timer;
+    ktime_t inject_period;
+    button_inject_t inject;
+    unsigned int inject_next;
+    button_t inject_buttons[IMX_BUTTON_NUM];
+    /* LED bindings, led.ko is only pinned once the first one is set */
+    spinlock_t bind_lock;
+    button_binding_t bindings[IMX_BUTTON_NUM][BUTTON_EVENT_NUM];
+    int (*led_route)(u32 mask, unsigned int action, const led_pattern_t* pattern);
+    int (*led_route_check)(u32 mask, unsigned int action, const led_pattern_t* pattern);
+    /*
+     * FRAM journal: events are collected under journal_lock and written out
+     * in batches by journal_work, so a burst costs one I2C transfer.
+     */
+    spinlock_t journal_lock;
+    button_journal_rec_t journal_backlog[BUTTON_JOURNAL_BACKLOG];
+    unsigned int journal_pending;
+    struct work_struct journal_work;
+    struct mutex journal_mutex;
+    button_journal_rec_t journal_out[BUTTON_JOURNAL_BACKLOG];
+    unsigned int journal_slots;
+    u32 journal_seq;
+    int (*fm24_read_buf)(unsigned int chip, u32 address, void* buf, size_t len);
+    int (*fm24_write_vec)(unsigned int chip, const fm24_vec_t* vec, unsigned int num);
 } button_dev_t;
 
-void button_timer_callback(unsigned long arg)
+/*
+ * Open files share the device queue and only moderate their wakeups: a
+ * reader is woken, and polls readable, once batch presses are queued or
+ * delay_ms after it first saw the queue non-empty, whichever comes first.
+ */
+typedef struct {
+    struct list_head node;
+    button_dev_t* button_dev;
+    wait_queue_head_t wait;
+    struct timer_list timer;
+    button_moderation_t moderation;
+    int ready;
+} button_reader_t;
+
+static void button_set_status(button_t* button, button_status_t status)
+{
+    trace_button_debounce(button->imx_button->index, button->status, status);
+    button->status = status;
+}
+
+static unsigned int button_queued(button_dev_t* button_dev)
+{
+    return (button_dev->head + BUTTON_BUFSZ - button_dev->tail) % BUTTON_BUFSZ;
+}
+
+/* Called with button_dev->lock held. */
+static void button_reader_wake(button_reader_t* reader)
+{
+    reader->ready = 1;
+    if (waitqueue_active(&reader->wait))
+    {
+        reader->button_dev->stats.wakeups++;
+        wake_up_interruptible(&reader->wait);
+    }
+}
+
+/*
+ * Called with button_dev->lock held whenever the queue depth changes. A
+ * reader stays ready until the queue runs empty or it reads itself;
+ * otherwise it is woken once its batch is queued, and its latency timer is
+ * armed from the first press it sees waiting.
+ */
+static void button_readers_update(button_dev_t* button_dev)
+{
+    unsigned int queued = button_queued(button_dev);
+    button_reader_t* reader = NULL;
+
+    list_for_each_entry(reader, &button_dev->readers, node)
+    {
+        if (!queued)
+        {
+            reader->ready = 0;
+            del_timer(&reader->timer);
+        }
+        else if (reader->ready)
+        {
+            continue;
+        }
+        else if (queued >= reader->moderation.batch)
+        {
+            button_reader_wake(reader);
+        }
+        else if (reader->moderation.delay_ms && !timer_pending(&reader->timer))
+        {
+            mod_timer(&reader->timer, jiffies + msecs_to_jiffies(reader->moderation.delay_ms));
+        }
+    }
+}
+
+static void button_enqueue(button_dev_t* button_dev, int index)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&button_dev->lock, flags);
+    button_dev->buf[button_dev->head++] = index;
+    if (button_dev->head == BUTTON_BUFSZ)
+        button_dev->head = 0;
+    if (button_dev->head == button_dev->tail)
+    {
+        button_dev->tail++;
+        if (button_dev->tail == BUTTON_BUFSZ)
+            button_dev->tail = 0;
+        button_dev->stats.dropped++;
+    }
+    button_dev->stats.enqueued++;
+    trace_button_enqueue(index, button_dev->head, button_dev->tail);
+    button_readers_update(button_dev);
+    spin_unlock_irqrestore(&button_dev->lock, flags);
+}
+
+static void button_reader_timer(struct timer_list* t)
+{
+    button_reader_t* reader = from_timer(reader, t, timer);
+    unsigned long flags;
+
+    spin_lock_irqsave(&reader->button_dev->lock, flags);
+    if (!reader->ready && reader->button_dev->head != reader->button_dev->tail)
+        button_reader_wake(reader);
+    spin_unlock_irqrestore(&reader->button_dev->lock, flags);
+}
+
+/* Take the LED action bound to a button event, if any. */
+static void button_route(button_dev_t* button_dev, button_t* button, unsigned int event)
+{
+    int index = button->imx_button->index;
+    button_binding_t* binding = &button_dev->bindings[index][event];
+    unsigned long flags;
+    int ret = 0;
+
+    spin_lock_irqsave(&button_dev->bind_lock, flags);
+    if (binding->action != LED_ACTION_NONE)
+    {
+        ret = button_dev->led_route(binding->leds, binding->action, &binding->pattern);
+        trace_button_route(index, event, binding->action, binding->leds, ret);
+        button_dev->stats.routed++;
+    }
+    spin_unlock_irqrestore(&button_dev->bind_lock, flags);
+}
+
+static void button_journal(button_dev_t* button_dev, button_t* button, unsigned int event)
+{
+    button_journal_rec_t* rec = NULL;
+    unsigned long flags;
+    u64 ms = ktime_to_ns(ktime_get_real());
+    u32 msec = 0;
+
+    do_div(ms, NSEC_PER_MSEC);
+    msec = do_div(ms, MSEC_PER_SEC);
+
+    spin_lock_irqsave(&button_dev->journal_lock, flags);
+    if (button_dev->journal_pending < BUTTON_JOURNAL_BACKLOG)
+    {
+        rec = button_dev->journal_backlog + button_dev->journal_pending++;
+        rec->sec = cpu_to_le32((u32)ms);
+        rec->msec = cpu_to_le16(msec);
+        rec->index = button->imx_button->index;
+        rec->event = event;
+    }
+    else
+    {
+        button_dev->stats.journal_dropped++;
+    }
+    spin_unlock_irqrestore(&button_dev->journal_lock, flags);
+    schedule_work(&button_dev->journal_work);
+}
+
+/* Write the events collected since the last run, records first, then head. */
+static void button_journal_work(struct work_struct* work)
+{
+    button_dev_t* button_dev = container_of(work, button_dev_t, journal_work);
+    button_journal_rec_t* out = button_dev->journal_out;
+    button_journal_head_t head;
+    fm24_vec_t vec[3];
+    unsigned int slots = button_dev->journal_slots;
+    unsigned int n = 0, skip = 0, slot = 0, first = 0, num = 0;
+    u32 records = journal_base + sizeof(head);
+    int ret = 0;
+
+    mutex_lock(&button_dev->journal_mutex);
+    spin_lock_irq(&button_dev->journal_lock);
+    n = button_dev->journal_pending;
+    memcpy(out, button_dev->journal_backlog, n * sizeof(*out));
+    button_dev->journal_pending = 0;
+    spin_unlock_irq(&button_dev->journal_lock);
+    if (!n)
+        goto out;
+
+    /* records that would be overwritten within this batch are not written */
+    if (n > slots)
+        skip = n - slots;
+    slot = (button_dev->journal_seq + skip) % slots;
+    first = min(n - skip, slots - slot);
+    vec[num].address = records + slot * sizeof(*out);
+    vec[num].buf = out + skip;
+    vec[num++].len = first * sizeof(*out);
+    if (first < n - skip)
+    {
+        vec[num].address = records;
+        vec[num].buf = out + skip + first;
+        vec[num++].len = (n - skip - first) * sizeof(*out);
+    }
+    head.magic = cpu_to_le32(BUTTON_JOURNAL_MAGIC);
+    head.seq = cpu_to_le32(button_dev->journal_seq + n);
+    vec[num].address = journal_base;
+    vec[num].buf = &head;
+    vec[num++].len = sizeof(head);
+
+    ret = button_dev->fm24_write_vec(journal_chip, vec, num);
+    spin_lock_irq(&button_dev->journal_lock);
+    if (ret < 0)
+    {
+        button_dev->stats.journal_errors++;
+    }
+    else
+    {
+        button_dev->journal_seq += n;
+        button_dev->stats.journaled += n;
+    }
+    spin_unlock_irq(&button_dev->journal_lock);
+    if (ret < 0)
+        imx_err("journal write of %u events failed: %d\n", n, ret);
+out:
+    mutex_unlock(&button_dev->journal_mutex);
+}
+
+/* Pick up the journal left in FRAM, or start a new one. */
+static int button_journal_init(button_dev_t* button_dev)
+{
+    ssize_t (*chip_size)(unsigned int chip) = NULL;
+    button_journal_head_t head;
+    fm24_vec_t vec;
+    ssize_t size = 0;
+    int ret = 0;
+
+    if (journal_size < sizeof(head) + sizeof(button_journal_rec_t))
+        return -EINVAL;
+    button_dev->journal_slots = (journal_size - sizeof(head)) / sizeof(button_journal_rec_t);
+
+    button_dev->fm24_read_buf = symbol_get(fm24_read_buf);
+    button_dev->fm24_write_vec = symbol_get(fm24_write_vec);
+    if (!button_dev->fm24_read_buf || !button_dev->fm24_write_vec)
+    {
+        imx_err("journal needs fm24cxx loaded.\n");
+        ret = -ENODEV;
+        goto fail;
+    }
+
+    /* only needed here, so it is not kept pinned with the other two */
+    chip_size = symbol_get(fm24_chip_size);
+    if (!chip_size)
+    {
+        ret = -ENODEV;
+        goto fail;
+    }
+    size = chip_size(journal_chip);
+    symbol_put(fm24_chip_size);
+    if (size < 0)
+    {
+        ret = size;
+        goto fail;
+    }
+    if ((u64)journal_base + journal_size > (u64)size)
+    {
+        imx_err("journal region %u+%u does not fit fm24 chip %d of %zd bytes.\n",
+                journal_base, journal_size, journal_chip, size);
+        ret = -EINVAL;
+        goto fail;
+    }
+    ret = button_dev->fm24_read_buf(journal_chip, journal_base, &head, sizeof(head));
+    if (ret < 0)
+        goto fail;
+    if (le32_to_cpu(head.magic) == BUTTON_JOURNAL_MAGIC)
+    {
+        button_dev->journal_seq = le32_to_cpu(head.seq);
+        imx_info("journal resumed at event %u\n", button_dev->journal_seq);
+        return 0;
+    }
+
+    head.magic = cpu_to_le32(BUTTON_JOURNAL_MAGIC);
+    head.seq = 0;
+    vec.address = journal_base;
+    vec.buf = &head;
+    vec.len = sizeof(head);
+    ret = button_dev->fm24_write_vec(journal_chip, &vec, 1);
+    if (ret < 0)
+        goto fail;
+    imx_info("journal created, %u slots\n", button_dev->journal_slots);
+    return 0;
+fail:
+    if (button_dev->fm24_read_buf)
+        symbol_put(fm24_read_buf);
+    if (button_dev->fm24_write_vec)
+        symbol_put(fm24_write_vec);
+    button_dev->fm24_read_buf = NULL;
+    button_dev->fm24_write_vec = NULL;
+    return ret;
+}
+
+/* Writes out what is still pending; the buttons must be quiet by now. */
+static void button_journal_deinit(button_dev_t* button_dev)
+{
+    if (!button_dev->fm24_write_vec)
+        return;
+    flush_work(&button_dev->journal_work);
+    symbol_put(fm24_read_buf);
+    symbol_put(fm24_write_vec);
+}
+
+/* An event of a debounced button: LED bindings first, then the journal. */
+static void button_event(button_dev_t* button_dev, button_t* button, unsigned int event)
+{
+    button_route(button_dev, button, event);
+    if (button_dev->fm24_write_vec && !button->synthetic)
+        button_journal(button_dev, button, event);
+}
+
+/*
+ * A falling edge starts debouncing. Returns 1 if the button must now be
+ * sampled by button_debounce() until it settles.
+ */
+static int button_edge(button_t* button, int level)
+{
+    if (level)
+        return 0;
+    button_set_status(button, BUTTON_DOWN);
+    return 1;
+}
+
+/*
+ * Feed one sampled level to the debounce state machine. A press is queued
+ * when the level is still low one sample after the edge. Returns 0 once the
+ * button has settled and edges may be taken again, 1 while it needs more
+ * samples.
+ */
+static int button_debounce(button_dev_t* button_dev, button_t* button, int level)
 {
-    button_t* button = (button_t*)arg;
-    button_dev_t* button_dev = (button_dev_t*)button->private_data;
-    int level = gpio_get_value(button->imx_button->gpio);
     if (button->status == BUTTON_DOWN)
     {
         if (!level)
         {
-            button_dev->buf[button_dev->head++] = button->imx_button->index;
-            if (button_dev->head == BUTTON_BUFSZ)
-                button_dev->head = 0;
-            if (button_dev->head == button_dev->tail)
-            {
-                button_dev->tail++;
-                if (button_dev->tail == BUTTON_BUFSZ)
-                    button_dev->tail = 0;
-            }
-            button->status = BUTTON_PRESSED;
- 
-            printk("%s pressed!\n", button->imx_button->name);
+            button_event(button_dev, button, BUTTON_EVENT_PRESS);
+            button_enqueue(button_dev, button->imx_button->index);
+            button_set_status(button, BUTTON_PRESSED);
+            button->pressed_at = jiffies;
+            button->long_sent = 0;
+            imx_dbg("%s pressed\n", button->imx_button->name);
         }
         else
         {
-            button->status = BUTTON_UP;
-            enable_irq(gpio_to_irq(button->imx_button->gpio));
-            return;
+            button_set_status(button, BUTTON_UP);
+            return 0;
         }
-        
     }
     else if (button->status == BUTTON_PRESSED)
     {
         if (level)
         {
-            button->status = BUTTON_UP;
-            printk("%s releasing!\n", button->imx_button->name);
+            button_event(button_dev, button, BUTTON_EVENT_RELEASE);
+            button_set_status(button, BUTTON_UP);
+            imx_dbg("%s releasing\n", button->imx_button->name);
+        }
+        else if (!button->long_sent && long_press_ms &&
+                 time_after_eq(jiffies, button->pressed_at + msecs_to_jiffies(long_press_ms)))
+        {
+            button->long_sent = 1;
+            button_event(button_dev, button, BUTTON_EVENT_LONG_PRESS);
         }
     }
     else if (button->status == BUTTON_UP)
     {
         if (level)
         {
-            button->status = BUTTON_RELEASED;
-            enable_irq(gpio_to_irq(button->imx_button->gpio));
-            printk("%s released!\n", button->imx_button->name);
-            return;
+            button_set_status(button, BUTTON_RELEASED);
+            imx_dbg("%s released\n", button->imx_button->name);
+            return 0;
         }
     }
-    //setup_timer(&button->timer, button_timer_callback, (unsigned long)button);
+    return 1;
+}
+
+void button_timer_callback(struct timer_list* t)
+{
+    button_t* button = from_timer(button, t, timer);
+    button_dev_t* button_dev = (button_dev_t*)button->private_data;
+    int level = gpio_get_value(button->imx_button->gpio);
+
+    if (!button_debounce(button_dev, button, level))
+    {
+        enable_irq(gpio_to_irq(button->imx_button->gpio));
+        return;
+    }
     button->timer.expires = jiffies + HZ / 100;
     add_timer(&button->timer);
 }
@@ -120,22 +528,90 @@ static irqreturn_t button_irq(int irq, void* dev_id)
     button_t* button = (button_t*)dev_id;
     int level = 0;
 
-    printk("enter button irq\n");
     level = gpio_get_value(button->imx_button->gpio);
-    printk("%s level = %d\n",button->imx_button->name, level ? 1 : 0);
-    if (!level)
+    trace_button_irq(button->imx_button->index, level ? 1 : 0);
+    imx_dbg("%s irq, level = %d\n", button->imx_button->name, level ? 1 : 0);
+    if (button_edge(button, level))
     {
         disable_irq_nosync(gpio_to_irq(button->imx_button->gpio));
-        button->status = BUTTON_DOWN;
-        
         button->timer.expires = jiffies + HZ / 100;
         add_timer(&button->timer);
     }
 
-    printk("exit button irq\n");
     return IRQ_RETVAL(IRQ_HANDLED);
 }
 
+/*
+ * One synthetic press: the edge and level samples a real button would give,
+ * with inject.bounce rejected bounces first, then press, hold and release.
+ */
+static void button_inject_press(button_dev_t* button_dev, button_t* button)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < button_dev->inject.bounce; i++)
+    {
+        button_edge(button, 0);
+        button_debounce(button_dev, button, 1);
+    }
+    button_edge(button, 0);
+    button_debounce(button_dev, button, 0);
+    button_debounce(button_dev, button, 1);
+    button_debounce(button_dev, button, 1);
+}
+
+static enum hrtimer_restart button_inject_timer(struct hrtimer* timer)
+{
+    button_dev_t* button_dev = container_of(timer, button_dev_t, inject_timer);
+    unsigned long overruns = hrtimer_forward_now(timer, button_dev->inject_period);
+    unsigned long injected = 0;
+    unsigned int i = 0;
+
+    /*
+     * Catch up on expiries lost to latency so the average rate holds, but
+     * only so far: after a long stall the rest are skipped, not replayed.
+     */
+    if (overruns > BUTTON_INJECT_BURST_MAX)
+        overruns = BUTTON_INJECT_BURST_MAX;
+    while (overruns-- && button_dev->inject.count)
+    {
+        for (i = 0; i < IMX_BUTTON_NUM; i++)
+        {
+            if (button_dev->inject.mask & (1 << button_dev->inject_next))
+                break;
+            if (++button_dev->inject_next == IMX_BUTTON_NUM)
+                button_dev->inject_next = 0;
+        }
+        button_inject_press(button_dev, button_dev->inject_buttons + button_dev->inject_next);
+        if (++button_dev->inject_next == IMX_BUTTON_NUM)
+            button_dev->inject_next = 0;
+        button_dev->inject.count--;
+        injected++;
+    }
+
+    spin_lock(&button_dev->lock);
+    button_dev->stats.injected += injected;
+    spin_unlock(&button_dev->lock);
+    return button_dev->inject.count ? HRTIMER_RESTART : HRTIMER_NORESTART;
+}
+
+static int button_inject_start(button_dev_t* button_dev, const button_inject_t* inject)
+{
+    if (inject->count && (!inject->mask || (inject->mask >> IMX_BUTTON_NUM) ||
+                          !inject->rate || inject->rate > BUTTON_INJECT_RATE_MAX ||
+                          inject->bounce > BUTTON_INJECT_BOUNCE_MAX))
+        return -EINVAL;
+
+    hrtimer_cancel(&button_dev->inject_timer);
+    button_dev->inject = *inject;
+    button_dev->inject_next = 0;
+    if (!inject->count)
+        return 0;
+    button_dev->inject_period = ktime_set(0, NSEC_PER_SEC / inject->rate);
+    hrtimer_start(&button_dev->inject_timer, button_dev->inject_period, HRTIMER_MODE_REL);
+    return 0;
+}
+
 static int button_gpio_init(button_dev_t* button_dev, button_t* button, imx_button_t* imx_button)
 {
     int ret = 0;
@@ -143,24 +619,24 @@ static int button_gpio_init(button_dev_t* button_dev, button_t* button, imx_butt
 
     button->private_data = button_dev;
     button->imx_button = imx_button;
-    setup_timer(&button->timer, button_timer_callback, (unsigned long)button);
+    timer_setup(&button->timer, button_timer_callback, 0);
     gpio_free(imx_button->gpio);
     ret = gpio_request(imx_button->gpio, imx_button->name);
     if (ret != 0)
     {
-        printk(KERN_ERR "%s gpio init failed.\n", imx_button->name);
+        imx_err("%s gpio init failed.\n", imx_button->name);
         return ret;
     }
 
     gpio_direction_input(imx_button->gpio);
     irqno = gpio_to_irq(imx_button->gpio);
-    printk("request irqno:%d\n", irqno);
-    set_irq_type(irqno, IRQF_TRIGGER_FALLING);
-    //set_irq_type(irqno, IRQ_TYPE_EDGE_FALLING);
+    imx_dbg("request irqno:%d\n", irqno);
+    irq_set_irq_type(irqno, IRQ_TYPE_EDGE_FALLING);
     ret = request_irq(irqno, button_irq, IRQF_DISABLED, imx_button->name, button);
     if (ret != 0)
     {
-        printk(KERN_ERR "%s request irq failed!, irq:%d\n", imx_button->name, irqno);
+        imx_err("%s request irq failed!, irq:%d\n", imx_button->name, irqno);
+        gpio_free(imx_button->gpio);
         return ret;
     }
 
@@ -170,36 +646,60 @@ static int button_gpio_init(button_dev_t* button_dev, button_t* button, imx_butt
 static void button_gpio_deinit(button_t* button)
 {
     int irqno = gpio_to_irq(button->imx_button->gpio);
-    printk("free irqno:%d\n", irqno);
+    imx_dbg("free irqno:%d\n", irqno);
     free_irq(irqno, button);
+    del_timer_sync(&button->timer);
     gpio_free(button->imx_button->gpio);
 }
 
 static int button_open(struct inode* inode, struct file* file)
 {
     button_dev_t* button_dev = container_of(inode->i_cdev, button_dev_t, cdev);
+    button_reader_t* reader = kzalloc(sizeof(*reader), GFP_KERNEL);
 
+    if (!reader)
+        return -ENOMEM;
+    reader->button_dev = button_dev;
+    reader->moderation.batch = 1;
+    init_waitqueue_head(&reader->wait);
+    timer_setup(&reader->timer, button_reader_timer, 0);
 
-    file->private_data = button_dev;
+    spin_lock_irq(&button_dev->lock);
+    list_add_tail(&reader->node, &button_dev->readers);
+    button_readers_update(button_dev);
+    spin_unlock_irq(&button_dev->lock);
+    file->private_data = reader;
 
     return 0;
 }
 
 static int button_release(struct inode* inode, struct file* file)
 {
+    button_reader_t* reader = file->private_data;
+    button_dev_t* button_dev = reader->button_dev;
+
+    spin_lock_irq(&button_dev->lock);
+    list_del(&reader->node);
+    spin_unlock_irq(&button_dev->lock);
+    del_timer_sync(&reader->timer);
+    kfree(reader);
 
     return 0;
 }
 
 static ssize_t button_read(struct file* file, char __user* rd_data, size_t rd_len, loff_t* offset)
 {
-    button_dev_t* button_dev = file->private_data;
+    button_reader_t* reader = file->private_data;
+    button_dev_t* button_dev = reader->button_dev;
+    unsigned char buf[BUTTON_BUFSZ];
     int ret = 0;
+
+    spin_lock_irq(&button_dev->lock);
     while (rd_len)
     {
         if (button_dev->head != button_dev->tail)
         {
-            put_user(button_dev->buf[button_dev->tail++], rd_data++);
+            buf[ret] = button_dev->buf[button_dev->tail++];
             if (button_dev->tail >= BUTTON_BUFSZ)
                 button_dev->tail = 0;
             ret++;
@@ -211,8 +711,167 @@ static ssize_t button_read(struct file* file, char __user* rd_data, size_t rd_le
         
         rd_len--;
     }
+    button_dev->stats.reads++;
+    button_dev->stats.dequeued += ret;
+    trace_button_dequeue(ret, button_dev->head, button_dev->tail);
+
+    /* what this reader left over starts a new batch for it */
+    reader->ready = 0;
+    del_timer(&reader->timer);
+    button_readers_update(button_dev);
+    spin_unlock_irq(&button_dev->lock);
+
+    if (copy_to_user(rd_data, buf, ret))
+        return -EFAULT;
+    return ret;
+}
+
+/*
+ * read() never blocks; consumers wait for key presses with poll/epoll, which
+ * reports readable once the reader's moderation allows it.
+ */
+static unsigned int button_poll(struct file* file, poll_table* wait)
+{
+    button_reader_t* reader = file->private_data;
+    unsigned int mask = 0;
+
+    poll_wait(file, &reader->wait, wait);
+    if (reader->ready)
+        mask |= POLLIN | POLLRDNORM;
+    return mask;
+}
+
+static int button_set_moderation(button_reader_t* reader, const button_moderation_t* moderation)
+{
+    button_dev_t* button_dev = reader->button_dev;
+
+    if (!moderation->batch || moderation->batch > BUTTON_QUEUE_LEN ||
+        moderation->delay_ms > BUTTON_MODERATION_DELAY_MAX)
+        return -EINVAL;
+
+    spin_lock_irq(&button_dev->lock);
+    reader->moderation = *moderation;
+    if (!reader->ready)
+    {
+        del_timer(&reader->timer);
+        button_readers_update(button_dev);
+    }
+    spin_unlock_irq(&button_dev->lock);
+    return 0;
+}
 
+/* Must be called with ctl_lock held. */
+static int button_set_binding(button_dev_t* button_dev, const button_binding_t* binding)
+{
+    int ret = 0;
 
+    if (binding->index >= IMX_BUTTON_NUM || binding->event >= BUTTON_EVENT_NUM)
+        return -EINVAL;
+
+    if (binding->action != LED_ACTION_NONE)
+    {
+        if (!button_dev->led_route)
+        {
+            button_dev->led_route_check = symbol_get(led_route_check);
+            if (!button_dev->led_route_check)
+                return -ENODEV;
+            spin_lock_irq(&button_dev->bind_lock);
+            button_dev->led_route = symbol_get(led_route);
+            spin_unlock_irq(&button_dev->bind_lock);
+            if (!button_dev->led_route)
+            {
+                symbol_put(led_route_check);
+                button_dev->led_route_check = NULL;
+                return -ENODEV;
+            }
+        }
+        ret = button_dev->led_route_check(binding->leds, binding->action, &binding->pattern);
+        if (ret < 0)
+            return ret;
+    }
+
+    spin_lock_irq(&button_dev->bind_lock);
+    button_dev->bindings[binding->index][binding->event] = *binding;
+    spin_unlock_irq(&button_dev->bind_lock);
+    return 0;
+}
+
+static long button_unlocked_ioctl(struct file* file, unsigned int cmd, unsigned long arg)
+{
+    button_reader_t* reader = file->private_data;
+    button_dev_t* button_dev = reader->button_dev;
+    button_moderation_t moderation;
+    button_binding_t binding;
+    button_inject_t inject;
+    button_stats_t stats;
+    unsigned int index = 0, event = 0;
+    int ret = 0;
+
+    switch (cmd)
+    {
+    case BUTTON_IOC_INJECT:
+        if (!capable(CAP_SYS_ADMIN))
+            return -EPERM;
+        if (copy_from_user(&inject, (void __user*)arg, sizeof(inject)))
+            return -EFAULT;
+        mutex_lock(&button_dev->ctl_lock);
+        ret = button_inject_start(button_dev, &inject);
+        mutex_unlock(&button_dev->ctl_lock);
+        break;
+    case BUTTON_IOC_GET_STATS:
+        spin_lock_irq(&button_dev->lock);
+        stats = button_dev->stats;
+        stats.queued = button_queued(button_dev);
+        stats.inject_left = button_dev->inject.count;
+        spin_unlock_irq(&button_dev->lock);
+        spin_lock_irq(&button_dev->bind_lock);
+        stats.routed = button_dev->stats.routed;
+        spin_unlock_irq(&button_dev->bind_lock);
+        spin_lock_irq(&button_dev->journal_lock);
+        stats.journaled = button_dev->stats.journaled;
+        stats.journal_dropped = button_dev->stats.journal_dropped;
+        stats.journal_errors = button_dev->stats.journal_errors;
+        spin_unlock_irq(&button_dev->journal_lock);
+        if (copy_to_user((void __user*)arg, &stats, sizeof(stats)))
+            return -EFAULT;
+        break;
+    case BUTTON_IOC_SET_MODERATION:
+        if (copy_from_user(&moderation, (void __user*)arg, sizeof(moderation)))
+            return -EFAULT;
+        ret = button_set_moderation(reader, &moderation);
+        break;
+    case BUTTON_IOC_GET_MODERATION:
+        spin_lock_irq(&button_dev->lock);
+        moderation = reader->moderation;
+        spin_unlock_irq(&button_dev->lock);
+        if (copy_to_user((void __user*)arg, &moderation, sizeof(moderation)))
+            return -EFAULT;
+        break;
+    case BUTTON_IOC_SET_BINDING:
+        if (copy_from_user(&binding, (void __user*)arg, sizeof(binding)))
+            return -EFAULT;
+        mutex_lock(&button_dev->ctl_lock);
+        ret = button_set_binding(button_dev, &binding);
+        mutex_unlock(&button_dev->ctl_lock);
+        break;
+    case BUTTON_IOC_GET_BINDING:
+        if (copy_from_user(&binding, (void __user*)arg, sizeof(binding)))
+            return -EFAULT;
+        if (binding.index >= IMX_BUTTON_NUM || binding.event >= BUTTON_EVENT_NUM)
+            return -EINVAL;
+        index = binding.index;
+        event = binding.event;
+        spin_lock_irq(&button_dev->bind_lock);
+        binding = button_dev->bindings[index][event];
+        spin_unlock_irq(&button_dev->bind_lock);
+        binding.index = index;
+        binding.event = event;
+        if (copy_to_user((void __user*)arg, &binding, sizeof(binding)))
+            return -EFAULT;
+        break;
+    default:
+        return -ENOTTY;
+    }
     return ret;
 }
 
@@ -221,6 +880,8 @@ const struct file_operations button_ops = {
     .open = button_open,
     .release = button_release,
     .read = button_read,
+    .poll = button_poll,
+    .unlocked_ioctl = button_unlocked_ioctl,
 };
 
 button_dev_t* button_dev = NULL;
@@ -230,18 +891,52 @@ int __init button_init(void)
 {
     int ret = 0;
     int i = 0;
-    printk("enter button init\n");
     dev_t devno = MKDEV(button_dev_major, 0);
 
+    for (i = 0; i < gpios_num; i++)
+    {
+        imx_buttons[i].gpio = gpios[i];
+    }
+    for (i = 0; i < IMX_BUTTON_NUM; i++)
+    {
+        if (!gpio_is_valid(imx_buttons[i].gpio))
+        {
+            imx_err("%s has no valid gpio.\n", imx_buttons[i].name);
+            return -EINVAL;
+        }
+    }
+
     button_dev = kzalloc(sizeof(button_dev_t), GFP_KERNEL);
+    if (!button_dev)
+        return -ENOMEM;
+    spin_lock_init(&button_dev->lock);
+    spin_lock_init(&button_dev->bind_lock);
+    INIT_LIST_HEAD(&button_dev->readers);
+    mutex_init(&button_dev->ctl_lock);
+    hrtimer_setup(&button_dev->inject_timer, button_inject_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    for (i = 0; i < IMX_BUTTON_NUM; i++)
+    {
+        button_dev->inject_buttons[i].imx_button = imx_buttons + i;
+        button_dev->inject_buttons[i].private_data = button_dev;
+        button_dev->inject_buttons[i].synthetic = 1;
+    }
+    spin_lock_init(&button_dev->journal_lock);
+    mutex_init(&button_dev->journal_mutex);
+    INIT_WORK(&button_dev->journal_work, button_journal_work);
+    if (journal_chip >= 0 && (ret = button_journal_init(button_dev)) < 0)
+    {
+        imx_err("journal init failed: %d\n", ret);
+        kfree(button_dev);
+        return ret;
+    }
 
     if (button_dev_major)
     {
         ret = register_chrdev_region(devno, 1, BUTTON_DEV_NAME);
         if (ret != 0)
         {
-            printk(KERN_ERR "register chrdev region failed, major=%d\n", button_dev_major);
-            return ret;
+            imx_err("register chrdev region failed, major=%d\n", button_dev_major);
+            goto fail_journal;
         }
     }
     else
@@ -249,8 +944,8 @@ int __init button_init(void)
         ret = alloc_chrdev_region(&devno, 0, 1, BUTTON_DEV_NAME);
         if (ret != 0)
         {
-            printk(KERN_ERR "alloc chrdev region failed\n");
-            return ret;
+            imx_err("alloc chrdev region failed\n");
+            goto fail_journal;
         }
         button_dev_major = MAJOR(devno);
     }
@@ -263,22 +958,30 @@ int __init button_init(void)
 
     for (i = 0; i < IMX_BUTTON_NUM; i++)
     {
-        button_gpio_init(button_dev, button_dev->buttons + i, (imx_button_t*)imx_buttons + i);
+        ret = button_gpio_init(button_dev, button_dev->buttons + i, imx_buttons + i);
+        if (ret != 0)
+            goto fail_gpio;
     }
-    button_dev->head = 0;
-    button_dev->tail = 0;
 
-    printk("exit button init\n");
+    imx_info("%d buttons registered, major=%d\n", (int)IMX_BUTTON_NUM, button_dev_major);
     return 0;
+fail_gpio:
+    while (i--)
+    {
+        button_gpio_deinit(button_dev->buttons + i);
+    }
+    cdev_del(&button_dev->cdev);
 fail:
     unregister_chrdev_region(MKDEV(button_dev_major, 0), 1);
+fail_journal:
+    button_journal_deinit(button_dev);
+    kfree(button_dev);
     return ret;
 }
 
 void __exit button_exit(void)
 {
     int i = 0;
-    printk("enter button exit\n");
 
     for (i = 0; i < IMX_BUTTON_NUM; i++)
     {
@@ -286,10 +989,16 @@ void __exit button_exit(void)
     }
 
     cdev_del(&button_dev->cdev);
-    
+    hrtimer_cancel(&button_dev->inject_timer);
+    if (button_dev->led_route)
+    {
+        symbol_put(led_route);
+        symbol_put(led_route_check);
+    }
+    button_journal_deinit(button_dev);
+
     unregister_chrdev_region(MKDEV(button_dev_major, 0), 1);
     kfree(button_dev);
-    printk("exit button exit\n");
 }
 
 module_init(button_init);
@@ -0,0 +1,113 @@
+#ifndef __BUTTON_IOCTL_H__
+#define __BUTTON_IOCTL_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#include "../led/led_ioctl.h"
+
+/*
+ * ioctl interface of /dev/button, shared with userspace.
+ *
+ * A read returns one byte per press, holding the button index. The queue
+ * keeps the last BUTTON_QUEUE_LEN presses, whether or not the device is
+ * open, and is shared by all open files: each press is returned by one
+ * read only. A press arriving on a full queue overwrites the oldest one,
+ * which is counted as dropped.
+ *
+ * read() never blocks. Each open file has its own moderation, and poll()
+ * reports it readable once batch presses are queued, or delay_ms after it
+ * first saw a press waiting if delay_ms is not 0. The default batch of 1
+ * wakes the reader on every press.
+ *
+ * BUTTON_IOC_INJECT starts feeding synthetic presses into the same debounce
+ * and queue path the GPIO interrupts use, so consumers can be load tested
+ * without hardware. Injection runs from a kernel timer until count presses
+ * have been made; a new BUTTON_IOC_INJECT replaces a running one and a count
+ * of 0 stops it. It needs CAP_SYS_ADMIN. Expiries the timer misses are
+ * caught up on in its next run, up to a small burst; beyond that they are
+ * skipped and the presses come later.
+ *
+ * BUTTON_IOC_SET_BINDING has the driver act on the LEDs of led.ko itself
+ * when a button event is detected, in the same timer callback and before
+ * any reader is woken. Each button has one binding per event; a binding
+ * with LED_ACTION_NONE removes it. A long press fires once per press, when
+ * the button has been held for the long_press_ms module parameter.
+ */
+
+#define BUTTON_QUEUE_LEN            19
+#define BUTTON_INJECT_RATE_MAX      100000
+#define BUTTON_INJECT_BOUNCE_MAX    16
+#define BUTTON_MODERATION_DELAY_MAX 10000
+
+typedef struct button_inject {
+    __u32 mask;                 /* buttons to press, round robin by index */
+    __u32 count;                /* presses to inject, 0 stops injection */
+    __u32 rate;                 /* presses per second */
+    __u32 bounce;               /* rejected bounces before each press, 0 - 16 */
+} button_inject_t;
+
+#define BUTTON_EVENT_PRESS          0
+#define BUTTON_EVENT_RELEASE        1
+#define BUTTON_EVENT_LONG_PRESS     2
+#define BUTTON_EVENT_NUM            3
+
+typedef struct button_binding {
+    __u32 index;                /* button */
+    __u32 event;                /* BUTTON_EVENT_* */
+    __u32 action;               /* LED_ACTION_* */
+    __u32 leds;                 /* mask of LEDs to act on */
+    led_pattern_t pattern;      /* for LED_ACTION_PATTERN, index is unused */
+} button_binding_t;
+
+typedef struct button_moderation {
+    __u32 batch;                /* presses per wakeup, 1 - BUTTON_QUEUE_LEN */
+    __u32 delay_ms;             /* latency budget, 0 waits for a full batch */
+} button_moderation_t;
+
+typedef struct button_stats {
+    __u64 enqueued;             /* presses queued, real and injected */
+    __u64 dropped;              /* queued presses overwritten before a read */
+    __u64 dequeued;             /* presses returned by read() */
+    __u64 reads;                /* read() calls */
+    __u64 wakeups;              /* wakeups of sleeping readers */
+    __u64 injected;             /* synthetic presses fed to the debouncer */
+    __u32 queued;               /* presses waiting in the queue */
+    __u32 inject_left;          /* synthetic presses still to come */
+    __u64 routed;               /* LED actions taken by bindings */
+    __u64 journaled;            /* events written to the FRAM journal */
+    __u32 journal_dropped;      /* events lost to a full journal backlog */
+    __u32 journal_errors;       /* failed journal writes */
+} button_stats_t;
+
+/*
+ * FRAM journal of button events, written by the driver when loaded with
+ * journal_chip=<fm24 minor>. The region at journal_base holds a
+ * button_journal_head_t followed by a ring of button_journal_rec_t. seq
+ * counts the records ever written, so the newest record is in slot
+ * (seq - 1) % slots. The head is written after the records it accounts for,
+ * in the same I2C transfer, so a power loss never exposes a stale record.
+ * Synthetic presses are not journaled.
+ */
+#define BUTTON_JOURNAL_MAGIC        0x4a4e5442      /* "BTNJ" */
+
+typedef struct button_journal_head {
+    __le32 magic;
+    __le32 seq;
+} button_journal_head_t;
+
+typedef struct button_journal_rec {
+    __le32 sec;                 /* wall clock time of the event */
+    __le16 msec;
+    __u8 index;                 /* button */
+    __u8 event;                 /* BUTTON_EVENT_* */
+} button_journal_rec_t;
+
+#define BUTTON_IOC_MAGIC            'B'
+#define BUTTON_IOC_INJECT           _IOW(BUTTON_IOC_MAGIC, 1, button_inject_t)
+#define BUTTON_IOC_GET_STATS        _IOR(BUTTON_IOC_MAGIC, 2, button_stats_t)
+#define BUTTON_IOC_SET_MODERATION   _IOW(BUTTON_IOC_MAGIC, 3, button_moderation_t)
+#define BUTTON_IOC_GET_MODERATION   _IOR(BUTTON_IOC_MAGIC, 4, button_moderation_t)
+#define BUTTON_IOC_SET_BINDING      _IOW(BUTTON_IOC_MAGIC, 5, button_binding_t)
+#define BUTTON_IOC_GET_BINDING      _IOWR(BUTTON_IOC_MAGIC, 6, button_binding_t)
+
+#endif /* __BUTTON_IOCTL_H__ */
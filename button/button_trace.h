@@ -0,0 +1,99 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM imx_button
+
+#if !defined(__BUTTON_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __BUTTON_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(button_irq,
+    TP_PROTO(int index, int level),
+    TP_ARGS(index, level),
+    TP_STRUCT__entry(
+        __field(int, index)
+        __field(int, level)
+    ),
+    TP_fast_assign(
+        __entry->index = index;
+        __entry->level = level;
+    ),
+    TP_printk("button=%d level=%d", __entry->index, __entry->level)
+);
+
+TRACE_EVENT(button_debounce,
+    TP_PROTO(int index, int old_status, int new_status),
+    TP_ARGS(index, old_status, new_status),
+    TP_STRUCT__entry(
+        __field(int, index)
+        __field(int, old_status)
+        __field(int, new_status)
+    ),
+    TP_fast_assign(
+        __entry->index = index;
+        __entry->old_status = old_status;
+        __entry->new_status = new_status;
+    ),
+    TP_printk("button=%d status=%d->%d", __entry->index,
+              __entry->old_status, __entry->new_status)
+);
+
+TRACE_EVENT(button_enqueue,
+    TP_PROTO(int index, unsigned int head, unsigned int tail),
+    TP_ARGS(index, head, tail),
+    TP_STRUCT__entry(
+        __field(int, index)
+        __field(unsigned int, head)
+        __field(unsigned int, tail)
+    ),
+    TP_fast_assign(
+        __entry->index = index;
+        __entry->head = head;
+        __entry->tail = tail;
+    ),
+    TP_printk("button=%d head=%u tail=%u", __entry->index, __entry->head, __entry->tail)
+);
+
+TRACE_EVENT(button_dequeue,
+    TP_PROTO(int count, unsigned int head, unsigned int tail),
+    TP_ARGS(count, head, tail),
+    TP_STRUCT__entry(
+        __field(int, count)
+        __field(unsigned int, head)
+        __field(unsigned int, tail)
+    ),
+    TP_fast_assign(
+        __entry->count = count;
+        __entry->head = head;
+        __entry->tail = tail;
+    ),
+    TP_printk("count=%d head=%u tail=%u", __entry->count, __entry->head, __entry->tail)
+);
+
+TRACE_EVENT(button_route,
+    TP_PROTO(int index, unsigned int event, unsigned int action, unsigned int leds, int ret),
+    TP_ARGS(index, event, action, leds, ret),
+    TP_STRUCT__entry(
+        __field(int, index)
+        __field(unsigned int, event)
+        __field(unsigned int, action)
+        __field(unsigned int, leds)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        __entry->index = index;
+        __entry->event = event;
+        __entry->action = action;
+        __entry->leds = leds;
+        __entry->ret = ret;
+    ),
+    TP_printk("button=%d event=%u action=%u leds=0x%x ret=%d", __entry->index,
+              __entry->event, __entry->action, __entry->leds, __entry->ret)
+);
+
+#endif /* __BUTTON_TRACE_H__ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE button_trace
+#include <trace/define_trace.h>
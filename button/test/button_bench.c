@@ -0,0 +1,457 @@
+/*
+ * Edge-to-read latency and burst throughput benchmark for /dev/button.
+ *
+ * The driver is loaded on a host kernel with its buttons bound to gpio-mockup
+ * lines, e.g.
+ *
+ *   modprobe gpio-mockup gpio_mockup_ranges=-1,16
+ *   insmod button.ko gpios=<base>,<base+1>,<base+2>,<base+3>,<base+4>
+ *   mknod /dev/button c <major> 0
+ *   ./button_bench -d /sys/kernel/debug/gpio-mockup/gpiochip1 -l 0,1,2,3,4
+ *
+ * Edges are injected by writing the mockup line pull through debugfs. The
+ * driver only queues presses, one byte holding the button index each, so a
+ * press drives the line to 0 and the matching release is not expected back.
+ *
+ * The inject pattern needs no GPIOs: it has the driver generate presses at
+ * -r per second with BUTTON_IOC_INJECT and measures how fast a poll/read
+ * consumer drains them, how many overflow the queue and how many wakeups
+ * the reader took. -m and -w set the reader's wakeup moderation.
+ *
+ * The route pattern binds presses of the first button to toggling LED 0 of
+ * led.ko and times how long the LED line, given with -L, takes to follow a
+ * press edge.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../button_ioctl.h"
+#include "../../bench/bench_common.h"
+
+
+#define BENCH_DEV_NAME          "/dev/button"
+
+typedef struct {
+    int fd;
+    pending_t press;
+} bench_key_t;
+
+static bench_key_t keys[BENCH_MAX_KEYS];
+static int keys_num = 0;
+
+static samples_t read_lat;
+static unsigned long expected = 0, received = 0, unexpected = 0;
+
+static int set_line(int key, int level)
+{
+    return set_mockup_line(keys[key].fd, level);
+}
+
+static void drain(int fd)
+{
+    unsigned char buf[64];
+    long long now = now_ns();
+    long long t = 0;
+    ssize_t ret = 0;
+    int i = 0;
+
+    /* read() returns 0 once the driver queue is empty */
+    while ((ret = read(fd, buf, sizeof(buf))) > 0)
+    {
+        for (i = 0; i < ret; i++)
+        {
+            if (buf[i] >= keys_num || pending_pop(&keys[buf[i]].press, &t) < 0)
+            {
+                unexpected++;
+                continue;
+            }
+            received++;
+            sample_add(&read_lat, now - t);
+        }
+    }
+}
+
+/* Run the queued actions on schedule, reading presses back in between. */
+static int run_actions(const char* pattern, int fd, long long settle_ns)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    long long start = 0, end = 0, now = 0, wait = 0;
+    size_t next = 0;
+    int i = 0;
+
+    expected = received = unexpected = 0;
+    read_lat.n = 0;
+    for (i = 0; i < keys_num; i++)
+        pending_reset(&keys[i].press);
+
+    start = now_ns();
+    end = start + (actions_num ? actions[actions_num - 1].at : 0) + settle_ns;
+    while (1)
+    {
+        now = now_ns();
+        while (next < actions_num && start + actions[next].at <= now)
+        {
+            action_t* a = actions + next++;
+            long long t = now_ns();
+            if (set_line(a->key, a->level) < 0)
+                return -1;
+            if (a->expect == EXPECT_PRESS)
+            {
+                pending_push(&keys[a->key].press, t);
+                expected++;
+            }
+        }
+        now = now_ns();
+        if (next == actions_num && (now >= end || received == expected))
+            break;
+        wait = (next < actions_num ? start + actions[next].at : end) - now;
+        if (wait < 0)
+            wait = 0;
+        if (poll(&pfd, 1, (int)(wait / 1000000)) > 0)
+            drain(fd);
+    }
+    drain(fd);
+    end = now_ns();
+
+    printf("button.%s.injected %lu\n", pattern, expected);
+    printf("button.%s.received %lu\n", pattern, received);
+    printf("button.%s.dropped %lu\n", pattern, expected > received ? expected - received : 0);
+    printf("button.%s.unexpected %lu\n", pattern, unexpected);
+    printf("button.%s.events_per_sec %.1f\n", pattern, received * 1e9 / (double)(end - start));
+    report_samples("button.", pattern, "read_latency", &read_lat);
+    return 0;
+}
+
+static int get_stats(int fd, button_stats_t* stats)
+{
+    if (ioctl(fd, BUTTON_IOC_GET_STATS, stats) < 0)
+    {
+        perror("BUTTON_IOC_GET_STATS");
+        return -1;
+    }
+    return 0;
+}
+
+/* Let the driver generate presses and drain them as fast as they come. */
+static int run_inject(int fd, int count, int rate, int bounce, button_moderation_t* moderation)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    button_inject_t inject = {
+        .mask = (1u << keys_num) - 1,
+        .count = count,
+        .rate = rate,
+        .bounce = bounce,
+    };
+    button_stats_t s0, s1;
+    unsigned char buf[64];
+    unsigned long long bytes = 0, reads = 0, polls = 0;
+    long long start = 0, end = 0;
+    int idle_ms = 100;
+    ssize_t ret = 0;
+
+    if (ioctl(fd, BUTTON_IOC_SET_MODERATION, moderation) < 0)
+    {
+        perror("BUTTON_IOC_SET_MODERATION");
+        return -1;
+    }
+    idle_ms += moderation->delay_ms;
+    if (get_stats(fd, &s0) < 0)
+        return -1;
+    start = now_ns();
+    if (ioctl(fd, BUTTON_IOC_INJECT, &inject) < 0)
+    {
+        perror("BUTTON_IOC_INJECT");
+        return -1;
+    }
+    while (1)
+    {
+        polls++;
+        if (poll(&pfd, 1, idle_ms) == 0)
+        {
+            if (get_stats(fd, &s1) < 0)
+                return -1;
+            if (!s1.inject_left)
+                break;
+            continue;
+        }
+        while ((ret = read(fd, buf, sizeof(buf))) > 0)
+        {
+            bytes += ret;
+            reads++;
+        }
+        reads++;
+    }
+    /* the last poll timeout is not drain time; pick up a short last batch */
+    end = now_ns() - idle_ms * 1000000LL;
+    while ((ret = read(fd, buf, sizeof(buf))) > 0)
+        bytes += ret;
+    if (get_stats(fd, &s1) < 0)
+        return -1;
+
+    printf("button.inject.rate %d\n", rate);
+    printf("button.inject.bounce %d\n", bounce);
+    printf("button.inject.batch %u\n", moderation->batch);
+    printf("button.inject.delay_ms %u\n", moderation->delay_ms);
+    printf("button.inject.injected %llu\n", (unsigned long long)(s1.injected - s0.injected));
+    printf("button.inject.received %llu\n", bytes);
+    printf("button.inject.dropped %llu\n", (unsigned long long)(s1.dropped - s0.dropped));
+    printf("button.inject.reads %llu\n", reads);
+    printf("button.inject.polls %llu\n", polls);
+    printf("button.inject.wakeups %llu\n", (unsigned long long)(s1.wakeups - s0.wakeups));
+    printf("button.inject.events_per_sec %.1f\n", bytes * 1e9 / (double)(end - start));
+    printf("button.inject.events_per_wakeup %.2f\n",
+           s1.wakeups - s0.wakeups ? bytes / (double)(s1.wakeups - s0.wakeups) : 0.0);
+    return 0;
+}
+
+static int read_line(int fd)
+{
+    char c = 0;
+    if (pread(fd, &c, 1, 0) != 1)
+        return -1;
+    return c == '1';
+}
+
+/* Press the first button and spin until the bound LED line follows. */
+static int run_route(int fd, int led_fd, int iterations, long long hold)
+{
+    button_binding_t binding;
+    unsigned long timeouts = 0;
+    unsigned char buf[64];
+    long long t = 0;
+    int before = 0, level = 0;
+    int i = 0;
+
+    memset(&binding, 0, sizeof(binding));
+    binding.index = 0;
+    binding.event = BUTTON_EVENT_PRESS;
+    binding.action = LED_ACTION_TOGGLE;
+    binding.leds = 1;
+    if (ioctl(fd, BUTTON_IOC_SET_BINDING, &binding) < 0)
+    {
+        perror("BUTTON_IOC_SET_BINDING");
+        return -1;
+    }
+
+    read_lat.n = 0;
+    for (i = 0; i < iterations; i++)
+    {
+        before = read_line(led_fd);
+        t = now_ns();
+        if (before < 0 || set_line(0, 0) < 0)
+            return -1;
+        do
+        {
+            level = read_line(led_fd);
+        } while (level == before && now_ns() - t < hold);
+        if (level == before)
+            timeouts++;
+        else
+            sample_add(&read_lat, now_ns() - t);
+        usleep(hold / 1000);
+        set_line(0, 1);
+        usleep(hold / 1000);
+        while (read(fd, buf, sizeof(buf)) > 0)
+            ;
+    }
+
+    binding.action = LED_ACTION_NONE;
+    ioctl(fd, BUTTON_IOC_SET_BINDING, &binding);
+
+    printf("button.route.presses %d\n", iterations);
+    printf("button.route.timeouts %lu\n", timeouts);
+    report_samples("button.", "route", "led_latency", &read_lat);
+    return 0;
+}
+
+static void pattern_clean(int iterations, long long hold)
+{
+    long long t = 0;
+    int i = 0;
+    for (i = 0; i < iterations; i++)
+    {
+        add_action(t, i % keys_num, 0, EXPECT_PRESS);
+        add_action(t + hold, i % keys_num, 1, EXPECT_NONE);
+        t += 2 * hold;
+    }
+}
+
+/*
+ * Presses start every period, round robin over the keys, so several buttons
+ * are debouncing at once and the 20 byte driver queue can overflow.
+ */
+static void pattern_burst(int iterations, long long period, long long hold)
+{
+    long long t = 0;
+    int i = 0;
+    if (hold > period * keys_num / 2)
+        hold = period * keys_num / 2;
+    for (i = 0; i < iterations; i++)
+    {
+        add_action(t, i % keys_num, 0, EXPECT_PRESS);
+        add_action(t + hold, i % keys_num, 1, EXPECT_NONE);
+        t += period;
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s -d <gpio-mockup debugfs dir> -l <line,...> [options]\n"
+            "       %s -p inject [options]\n"
+            "  -f <dev>       button device (default " BENCH_DEV_NAME ")\n"
+            "  -p <pattern>   clean|burst|inject|route|all (default all)\n"
+            "  -L <line>      gpio-mockup line of LED 0, for route\n"
+            "  -n <count>     iterations per pattern (default 100)\n"
+            "  -h <ms>        hold time of a press (default 40)\n"
+            "  -r <hz>        burst and inject press rate (default 100)\n"
+            "  -b <count>     bounces per injected press (default 0)\n"
+            "  -k <count>     buttons used by inject (default 5)\n"
+            "  -m <count>     presses per reader wakeup (default 1)\n"
+            "  -w <ms>        wakeup latency budget (default 0)\n",
+            prog,
+            prog);
+}
+
+int main(int argc, char* const argv[])
+{
+    const char* debugfs = NULL;
+    const char* lines = NULL;
+    const char* dev = BENCH_DEV_NAME;
+    const char* pattern = "all";
+    const char* led_line = NULL;
+    int iterations = 100;
+    long long hold = 40000000LL;
+    long long period = 10000000LL;
+    int rate = 100;
+    int bounce = 0;
+    int inject_keys = 5;
+    button_moderation_t moderation = {.batch = 1, .delay_ms = 0};
+    char path[256];
+    char* tok = NULL;
+    char* list = NULL;
+    int fd = 0;
+    int opt = 0, i = 0, ret = 0;
+    static const char* const patterns[] = {"clean", "burst"};
+
+    while ((opt = getopt(argc, argv, "d:l:f:p:n:h:r:b:k:m:w:L:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd': debugfs = optarg; break;
+        case 'l': lines = optarg; break;
+        case 'f': dev = optarg; break;
+        case 'p': pattern = optarg; break;
+        case 'L': led_line = optarg; break;
+        case 'n': iterations = atoi(optarg); break;
+        case 'h': hold = atoll(optarg) * 1000000LL; break;
+        case 'r':
+            rate = atoi(optarg);
+            period = rate > 0 ? 1000000000LL / rate : 0;
+            break;
+        case 'b': bounce = atoi(optarg); break;
+        case 'k': inject_keys = atoi(optarg); break;
+        case 'm': moderation.batch = atoi(optarg); break;
+        case 'w': moderation.delay_ms = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations <= 0 || period <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    fd = open(dev, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(dev);
+        return 1;
+    }
+
+    if (strcmp(pattern, "inject") == 0)
+    {
+        keys_num = inject_keys > 0 && inject_keys < BENCH_MAX_KEYS ? inject_keys : 1;
+        while (read(fd, path, sizeof(path)) > 0)
+            ;
+        ret = run_inject(fd, iterations, rate, bounce, &moderation);
+        close(fd);
+        return ret ? 1 : 0;
+    }
+    if (!debugfs || !lines)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    list = strdup(lines);
+    for (tok = strtok(list, ","); tok && keys_num < BENCH_MAX_KEYS; tok = strtok(NULL, ","))
+    {
+        snprintf(path, sizeof(path), "%s/%s", debugfs, tok);
+        keys[keys_num].fd = open(path, O_WRONLY);
+        if (keys[keys_num].fd < 0)
+        {
+            perror(path);
+            return 1;
+        }
+        set_line(keys_num, 1);
+        keys_num++;
+    }
+    free(list);
+
+    read_lat.v = malloc(BENCH_MAX_SAMPLES * sizeof(long long));
+    if (!read_lat.v)
+    {
+        perror("malloc");
+        return 1;
+    }
+
+    usleep(100000);
+    drain(fd);
+
+    if (strcmp(pattern, "route") == 0)
+    {
+        int led_fd = -1;
+        snprintf(path, sizeof(path), "%s/%s", debugfs, led_line ? led_line : "");
+        if (!led_line || (led_fd = open(path, O_RDONLY)) < 0)
+        {
+            fprintf(stderr, "route needs the LED line given with -L\n");
+            return 1;
+        }
+        ret = run_route(fd, led_fd, iterations, hold);
+        close(led_fd);
+    }
+
+    for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++)
+    {
+        if (strcmp(pattern, "all") && strcmp(pattern, patterns[i]))
+            continue;
+        actions_num = 0;
+        switch (i)
+        {
+        case 0: pattern_clean(iterations, hold); break;
+        case 1: pattern_burst(iterations, period, hold); break;
+        }
+        if ((ret = run_actions(patterns[i], fd, 2 * hold)) < 0)
+            break;
+        usleep(2 * hold / 1000);
+        drain(fd);
+    }
+
+    for (i = 0; i < keys_num; i++)
+        close(keys[i].fd);
+    close(fd);
+    free(actions);
+    free(read_lat.v);
+    return ret ? 1 : 0;
+}
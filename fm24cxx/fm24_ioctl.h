@@ -0,0 +1,71 @@
+#ifndef __FM24_IOCTL_H__
+#define __FM24_IOCTL_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * ioctl interface of the /dev/fm24c* chip nodes, shared with userspace.
+ *
+ * A checksummed region is a range of the chip whose CRC32 (the zlib/IEEE
+ * one) the driver keeps current. The CRC is stored little endian in the
+ * four bytes at crc_at, outside the range. Every write that touches the
+ * range, from any file, the aggregate device or another kernel module,
+ * reads back only the bytes it replaces, updates the CRC from the old and
+ * new bytes and writes the data and the CRC in a single I2C transfer. A
+ * write that covers crc_at itself is taken as the caller managing the CRC
+ * and is passed through unchanged.
+ *
+ * FM24_IOC_SET_REGION declares region id of the chip, replacing any
+ * previous one; a len of 0 removes it. A region whose CRC falls inside, or
+ * whose range covers the CRC of, any other region of the chip is rejected
+ * with EINVAL, as are two regions sharing CRC bytes. With FM24_REGION_SEAL
+ * the CRC of the current contents is written, otherwise the stored one is
+ * adopted as is.
+ * FM24_IOC_VERIFY reads the whole region back and compares. Regions can
+ * also be declared with the regions= module parameter, in which case they
+ * are verified at load.
+ *
+ * A failed transfer is retried by the driver up to the retries= module
+ * parameter, with a sleeping backoff starting at retry_delay_us. Only NAKs,
+ * lost arbitration and bus faults are retried, and bus faults try the
+ * adapter's bus recovery first. FM24_IOC_GET_STATS returns the chip's
+ * counters since it was bound.
+ */
+
+#define FM24_REGION_MAX             8
+
+#define FM24_REGION_SEAL            0x1
+
+typedef struct fm24_region {
+    __u32 id;                   /* 0 - FM24_REGION_MAX - 1 */
+    __u32 base;
+    __u32 len;                  /* 0 removes the region */
+    __u32 crc_at;               /* chip address of the stored CRC */
+    __u32 flags;                /* FM24_REGION_*, only for SET_REGION */
+} fm24_region_t;
+
+typedef struct fm24_verify {
+    __u32 id;
+    __u32 ok;                   /* stored == computed */
+    __u32 stored;
+    __u32 computed;
+} fm24_verify_t;
+
+typedef struct fm24_stats {
+    __u64 xfers;                /* i2c transfers, retries included */
+    __u64 retries;
+    __u64 naks;                 /* failures by class */
+    __u64 arb_lost;
+    __u64 bus_errors;
+    __u64 recoveries;           /* bus recoveries that succeeded */
+    __u64 failures;             /* errors returned after the last retry */
+} fm24_stats_t;
+
+#define FM24_IOC_MAGIC              'F'
+#define FM24_IOC_SET_REGION         _IOW(FM24_IOC_MAGIC, 1, fm24_region_t)
+#define FM24_IOC_GET_REGION         _IOWR(FM24_IOC_MAGIC, 2, fm24_region_t)
+#define FM24_IOC_VERIFY             _IOWR(FM24_IOC_MAGIC, 3, fm24_verify_t)
+#define FM24_IOC_GET_STATS          _IOR(FM24_IOC_MAGIC, 4, fm24_stats_t)
+
+#endif /* __FM24_IOCTL_H__ */
@@ -0,0 +1,30 @@
+#ifndef __FM24_KERNEL_H__
+#define __FM24_KERNEL_H__
+
+#include <linux/types.h>
+
+/*
+ * In-kernel interface of fm24cxx.ko for other drivers. chip is the minor
+ * number of the chip's /dev node. The read and write calls sleep.
+ * fm24_chip_size() returns the chip's size in bytes, or -ENODEV if no chip
+ * is bound to that minor.
+ *
+ * fm24_write_vec() writes all pieces in a single i2c_transfer(), one write
+ * message per page, in the order given; a piece that must only land after
+ * the others, such as a ring head pointer, goes last. Pieces must not
+ * overlap, or the call fails with -EINVAL. Callers that must not
+ * depend on fm24cxx.ko being loaded take the calls with symbol_get().
+ */
+typedef struct fm24_vec {
+    u32 address;
+    const void* buf;
+    size_t len;
+} fm24_vec_t;
+
+#define FM24_VEC_MAX        8
+
+ssize_t fm24_chip_size(unsigned int chip);
+int fm24_read_buf(unsigned int chip, u32 address, void* buf, size_t len);
+int fm24_write_vec(unsigned int chip, const fm24_vec_t* vec, unsigned int num);
+
+#endif /* __FM24_KERNEL_H__ */
@@ -0,0 +1,78 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM fm24
+
+#if !defined(__FM24_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __FM24_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(fm24_xfer_start,
+    TP_PROTO(int bus, unsigned int addr, unsigned int offset, size_t len, int read),
+    TP_ARGS(bus, addr, offset, len, read),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(unsigned int, addr)
+        __field(unsigned int, offset)
+        __field(size_t, len)
+        __field(int, read)
+    ),
+    TP_fast_assign(
+        __entry->bus = bus;
+        __entry->addr = addr;
+        __entry->offset = offset;
+        __entry->len = len;
+        __entry->read = read;
+    ),
+    TP_printk("i2c-%d addr=0x%02x %s offset=%u len=%zu", __entry->bus, __entry->addr,
+              __entry->read ? "read" : "write", __entry->offset, __entry->len)
+);
+
+TRACE_EVENT(fm24_xfer_end,
+    TP_PROTO(int bus, unsigned int addr, unsigned int offset, size_t len, int read, int ret),
+    TP_ARGS(bus, addr, offset, len, read, ret),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(unsigned int, addr)
+        __field(unsigned int, offset)
+        __field(size_t, len)
+        __field(int, read)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        __entry->bus = bus;
+        __entry->addr = addr;
+        __entry->offset = offset;
+        __entry->len = len;
+        __entry->read = read;
+        __entry->ret = ret;
+    ),
+    TP_printk("i2c-%d addr=0x%02x %s offset=%u len=%zu ret=%d", __entry->bus, __entry->addr,
+              __entry->read ? "read" : "write", __entry->offset, __entry->len, __entry->ret)
+);
+
+TRACE_EVENT(fm24_retry,
+    TP_PROTO(int bus, unsigned int addr, unsigned int attempt, int err),
+    TP_ARGS(bus, addr, attempt, err),
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(unsigned int, addr)
+        __field(unsigned int, attempt)
+        __field(int, err)
+    ),
+    TP_fast_assign(
+        __entry->bus = bus;
+        __entry->addr = addr;
+        __entry->attempt = attempt;
+        __entry->err = err;
+    ),
+    TP_printk("i2c-%d addr=0x%02x retry %u after %d", __entry->bus, __entry->addr,
+              __entry->attempt, __entry->err)
+);
+
+#endif /* __FM24_TRACE_H__ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE fm24_trace
+#include <trace/define_trace.h>
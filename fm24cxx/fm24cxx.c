@@ -1,3 +1,5 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/i2c.h>
@@ -6,19 +8,23 @@
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <linux/delay.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/async.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/crc32.h>
+#include "imx28_compat.h"
+#include "imx28_log.h"
+#include "fm24_kernel.h"
+#include "fm24_ioctl.h"
+#define CREATE_TRACE_POINTS
+#include "fm24_trace.h"
 
 
 #define FM24_DEV_NAME       "fm24c02"
 
 
-typedef struct fm24_dev {
-    struct device* dev;
-    struct cdev cdev;
-    dev_t devno;
-    struct class* class;
-} fm24_dev_t;
-
-
 typedef struct {
     int busnum;
     const char* name;
@@ -30,165 +36,824 @@ typedef struct {
     uint32_t delay;
 } fm24_devinfo_t;
 
-typedef struct {
-    struct i2c_client client;
-    fm24_devinfo_t* devinfo;
-} fm24_client_t;
+/* One entry per chip, its index is the minor number of the chip's node. */
+static const fm24_devinfo_t fm24_devinfos[] = {
+    {1, "fm24c02", 0x50, 8, 2048 / 8, 1, 0x00, 5},
+};
+#define FM24_CHIPS          ARRAY_SIZE(fm24_devinfos)
+#define FM24_AGG_MINOR      FM24_CHIPS
+#define FM24_MINORS         (FM24_CHIPS + 1)
+#define FM24_AGG_MAX        8
+
+typedef struct fm24_crc_region {
+    fm24_region_t region;       /* len 0: unused */
+    u32 crc;                    /* stored CRC, valid if cached */
+    int cached;
+} fm24_crc_region_t;
+
+/*
+ * A chip bound by fm24_probe(). Open files and in-kernel users hold a
+ * reference; the client is cleared under the lock when the chip goes away,
+ * so late users get -ENODEV instead of a stale adapter.
+ */
+typedef struct fm24_chip {
+    struct kref ref;
+    struct mutex lock;          /* serialises transfers, guards client */
+    struct i2c_client* client;
+    const fm24_devinfo_t* info;
+    unsigned int minor;
+    fm24_crc_region_t regions[FM24_REGION_MAX];  /* guarded by lock */
+    fm24_stats_t stats;                         /* guarded by lock */
+} fm24_chip_t;
+
+typedef struct fm24_bus {
+    int busnum;
+    char name[16];
+    struct workqueue_struct* wq;
+} fm24_bus_t;
+
+/*
+ * Chips combined into /dev/fm24agg. With stripe set, consecutive stripe
+ * units go to consecutive members, otherwise members are concatenated.
+ * Every bus has its own worker, so one request runs on all buses at once.
+ */
+typedef struct fm24_agg {
+    struct cdev cdev;
+    fm24_chip_t* members[FM24_AGG_MAX];
+    unsigned int bus_of[FM24_AGG_MAX];     /* index of the member's bus */
+    unsigned int members_num;
+    fm24_bus_t buses[FM24_AGG_MAX];
+    unsigned int buses_num;
+    size_t stripe;
+    size_t size;
+    size_t chip_max;                        /* largest member */
+} fm24_agg_t;
+
+typedef struct fm24_agg_job {
+    struct work_struct work;
+    struct fm24_agg_req* req;
+    unsigned int bus;
+    int ret;
+} fm24_agg_job_t;
+
+typedef struct fm24_agg_req {
+    u32 pos;
+    u8* buf;
+    size_t len;
+    int write;
+    atomic_t pending;
+    struct completion done;
+    fm24_agg_job_t jobs[FM24_AGG_MAX];
+} fm24_agg_req_t;
+
+typedef struct fm24_dev {
+    struct cdev cdev;
+    dev_t devno;
+    struct class* class;
+    struct mutex lock;          /* guards chips */
+    fm24_chip_t* chips[FM24_CHIPS];
+    struct i2c_client* clients[FM24_CHIPS];     /* instantiated at load */
+    fm24_agg_t agg;
+} fm24_dev_t;
 
 static fm24_dev_t fm24_dev;
 
+IMX_LOG_DEFINE();
 
-const fm24_devinfo_t fm24_devinfos[] = {
-    {1, "fm24c02", 0x50, 8, 2048 / 8, 1, 0x00, 5},
-};
+static int aggregate[FM24_AGG_MAX];
+static int aggregate_num;
+module_param_array(aggregate, int, &aggregate_num, 0444);
+MODULE_PARM_DESC(aggregate, "fm24 chips (minors) to combine into /dev/fm24agg, none by default");
 
+static uint stripe;
+module_param(stripe, uint, 0444);
+MODULE_PARM_DESC(stripe, "bytes per stripe unit of /dev/fm24agg, 0 concatenates the chips");
 
-static int fm24_open(struct inode* inode, struct file* file)
+static char* regions[FM24_CHIPS * FM24_REGION_MAX];
+static int regions_num;
+module_param_array(regions, charp, &regions_num, 0444);
+MODULE_PARM_DESC(regions, "checksummed regions as chip:base:len:crc_at, verified at load");
+
+static uint retries = 3;
+module_param(retries, uint, 0644);
+MODULE_PARM_DESC(retries, "retries of a failed transfer, at most 10, 0 disables retry");
+
+static uint retry_delay_us = 50;
+module_param(retry_delay_us, uint, 0644);
+MODULE_PARM_DESC(retry_delay_us, "sleep before the first retry, doubled on each further one up to 10 ms");
+
+
+static void fm24_chip_free(struct kref* ref)
 {
-    unsigned int minor = iminor(inode);
-    printk(KERN_INFO "fm24 open minor=%d\n", minor);
-    fm24_devinfo_t* info = fm24_devinfos + minor;
+    kfree(container_of(ref, fm24_chip_t, ref));
+}
 
-    struct i2c_adapter* adap = i2c_get_adapter(info->busnum);
+static fm24_chip_t* fm24_chip_get(unsigned int minor)
+{
+    fm24_chip_t* chip = NULL;
 
-    printk(KERN_INFO "fm24 open\n");
+    if (minor >= FM24_CHIPS)
+        return NULL;
+    mutex_lock(&fm24_dev.lock);
+    chip = fm24_dev.chips[minor];
+    if (chip)
+        kref_get(&chip->ref);
+    mutex_unlock(&fm24_dev.lock);
+    return chip;
+}
 
-    if (!adap)
-        return -ENODEV;
-    
-    fm24_client_t* fm24_client = (fm24_client_t*)kzalloc(sizeof(*fm24_client), GFP_KERNEL);
-    if (!fm24_client)
+static void fm24_chip_put(fm24_chip_t* chip)
+{
+    kref_put(&chip->ref, fm24_chip_free);
+}
+
+static int fm24_check_range(const fm24_devinfo_t* info, u32 address, size_t len)
+{
+    if (address >= info->chip_size || len > info->chip_size - address)
+        return -EINVAL;
+    if (info->addr_size != 1 && info->addr_size != 2)
+        return -EINVAL;
+    return 0;
+}
+
+/* Device address and memory address bytes of a message starting at address. */
+static u16 fm24_msg_addr(const fm24_devinfo_t* info, u32 address, u8* buf)
+{
+    if (info->addr_size == 1)
     {
-        i2c_put_adapter(adap);
-        return -ENOMEM;
+        buf[0] = address & 0xFF;
+    }
+    else
+    {
+        buf[0] = (address >> 8) & 0xFF;
+        buf[1] = address & 0xFF;
     }
+    return ((address >> (8 * info->addr_size)) & info->addr_mask) | info->addr;
+}
 
-    snprintf(fm24_client->client.name, I2C_NAME_SIZE, info->name);
-    fm24_client->client.adapter = adap;
-    fm24_client->client.driver = &fm24_dev;
-    fm24_client->devinfo = info;
-    file->private_data = fm24_client;
+#define FM24_RETRIES_MAX        10
+#define FM24_RETRY_DELAY_MAX    10000
 
-    return 0;
+enum {
+    FM24_ERR_FATAL,             /* not worth a retry */
+    FM24_ERR_NAK,               /* chip busy or absent */
+    FM24_ERR_ARB,               /* arbitration lost to another master */
+    FM24_ERR_BUS,               /* timeout, short transfer or bus fault */
+};
+
+static int fm24_classify(int err)
+{
+    switch (err)
+    {
+    case -ENXIO:
+    case -EREMOTEIO:
+        return FM24_ERR_NAK;
+    case -EAGAIN:
+        return FM24_ERR_ARB;
+    case -ETIMEDOUT:
+    case -EIO:
+    case -EPROTO:
+    case -EBUSY:
+        return FM24_ERR_BUS;
+    default:
+        return FM24_ERR_FATAL;
+    }
 }
 
-static int fm24_release(struct inode* inode, struct file* file)
+/*
+ * i2c_transfer() with bounded retry. Transient failures are retried after
+ * a short sleep that doubles every time; a bus fault first gives the
+ * adapter's bus recovery a chance to free a stuck bus. Writes are resent
+ * whole, which FRAM takes as a plain rewrite. stats may be NULL.
+ */
+static int fm24_transfer(struct i2c_adapter* adap, const fm24_devinfo_t* info,
+                         fm24_stats_t* stats, struct i2c_msg* msgs, int num)
 {
-    printk(KERN_INFO "fm24 release\n");
-    fm24_client_t* fm24_client = file->private_data;
-    kfree(fm24_client);
+    unsigned int attempts = min_t(unsigned int, retries, FM24_RETRIES_MAX);
+    unsigned int delay = retry_delay_us;
+    unsigned int attempt = 0;
+    int class = 0;
+    int ret = 0;
+
+    for (;;)
+    {
+        ret = i2c_transfer(adap, msgs, num);
+        if (ret >= 0)
+            ret = ret == num ? 0 : -EIO;
+        if (stats)
+            stats->xfers++;
+        if (ret == 0)
+            return 0;
+
+        class = fm24_classify(ret);
+        if (stats)
+        {
+            if (class == FM24_ERR_NAK)
+                stats->naks++;
+            else if (class == FM24_ERR_ARB)
+                stats->arb_lost++;
+            else if (class == FM24_ERR_BUS)
+                stats->bus_errors++;
+        }
+        if (class == FM24_ERR_FATAL || attempt >= attempts)
+            break;
+
+        attempt++;
+        trace_fm24_retry(info->busnum, msgs[0].addr, attempt, ret);
+        if (class == FM24_ERR_BUS && imx_i2c_recover_bus(adap) == 0 && stats)
+            stats->recoveries++;
+        if (delay)
+            usleep_range(delay, delay * 2);
+        delay = min_t(unsigned int, delay * 2, FM24_RETRY_DELAY_MAX);
+        if (stats)
+            stats->retries++;
+    }
+    if (stats)
+        stats->failures++;
+    if (attempt)
+        imx_dbg("i2c-%d 0x%02x failed after %u retries: %d\n",
+                info->busnum, msgs[0].addr, attempt, ret);
+    return ret;
+}
+
+/* Must be called with chip->lock held. */
+static int __fm24_chip_read(struct i2c_adapter* adap, const fm24_devinfo_t* info, fm24_stats_t* stats,
+                            u32 address, void* buf, size_t len)
+{
+    struct i2c_msg msgs[2];
+    u8 addr_buf[2];
+    u8* p = buf;
+    size_t span = 1 << (8 * info->addr_size);
+    size_t block = 0;
+    int ret = 0;
+
+    while (len)
+    {
+        /* a read cannot run across the device address bits */
+        block = min_t(size_t, len, span - (address & (span - 1)));
+        msgs[0].addr = fm24_msg_addr(info, address, addr_buf);
+        msgs[0].flags = 0;
+        msgs[0].len = info->addr_size;
+        msgs[0].buf = addr_buf;
+        msgs[1].addr = msgs[0].addr;
+        msgs[1].flags = I2C_M_RD;
+        msgs[1].len = block;
+        msgs[1].buf = p;
+        trace_fm24_xfer_start(info->busnum, msgs[1].addr, address, block, 1);
+        ret = fm24_transfer(adap, info, stats, msgs, 2);
+        trace_fm24_xfer_end(info->busnum, msgs[1].addr, address, block, 1, ret);
+        if (ret < 0)
+            return ret;
+        len -= block;
+        address += block;
+        p += block;
+    }
     return 0;
 }
 
+static int fm24_chip_read(fm24_chip_t* chip, u32 address, void* buf, size_t len)
+{
+    int ret = 0;
+
+    if ((ret = fm24_check_range(chip->info, address, len)) < 0)
+        return ret;
+    mutex_lock(&chip->lock);
+    if (chip->client)
+        ret = __fm24_chip_read(chip->client->adapter, chip->info, &chip->stats, address, buf, len);
+    else
+        ret = -ENODEV;
+    mutex_unlock(&chip->lock);
+    return ret;
+}
 
-static int fm24_i2c_write(fm24_client_t* fm24, uint32_t address, const char __user* buf, size_t len)
+/* Must be called with chip->lock held, vec already range checked. */
+static int __fm24_chip_write_vec(struct i2c_adapter* adap, const fm24_devinfo_t* info, fm24_stats_t* stats,
+                                 const fm24_vec_t* vec, unsigned int num)
 {
-    struct i2c_msg msg;
+    struct i2c_msg* msgs = NULL;
+    u8* data = NULL;
+    u8* p = NULL;
+    unsigned int i = 0, n = 0, msgs_num = 0;
+    size_t bytes = 0, chunk = 0, done = 0;
+    u32 address = 0;
     int ret = 0;
 
-    if ((address < 0) || (address >= fm24->devinfo->chip_size))
+    for (i = 0; i < num; i++)
     {
-        return -EINVAL;
+        /* pages touched by this piece */
+        if (vec[i].len)
+            msgs_num += (vec[i].address + vec[i].len - 1) / info->page_size -
+                        vec[i].address / info->page_size + 1;
+        bytes += vec[i].len;
     }
+    if (msgs_num == 0)
+        return 0;
 
-    if ((address + len > fm24->devinfo->chip_size) || (address + len < 0))
+    msgs = kmalloc(msgs_num * sizeof(*msgs), GFP_KERNEL);
+    data = kmalloc(bytes + msgs_num * info->addr_size, GFP_KERNEL);
+    if (!msgs || !data)
     {
-        return -EINVAL;
+        ret = -ENOMEM;
+        goto out;
     }
-    msg.addr = fm24->devinfo->addr;
-    msg.flags = 0;
-    msg.len = fm24->devinfo->addr_size + len;
-    msg.buf = (uint8_t*)kzalloc(fm24->devinfo->addr_size + len, sizeof(uint8_t));
-    if (fm24->devinfo->addr_size == 1)
+
+    p = data;
+    for (i = 0; i < num; i++)
     {
-        msg.buf[0] = address & 0xFF;
+        for (done = 0; done < vec[i].len; done += chunk)
+        {
+            address = vec[i].address + done;
+            chunk = min_t(size_t, vec[i].len - done,
+                          info->page_size - (address & (info->page_size - 1)));
+            msgs[n].addr = fm24_msg_addr(info, address, p);
+            msgs[n].flags = 0;
+            msgs[n].len = info->addr_size + chunk;
+            msgs[n].buf = p;
+            memcpy(p + info->addr_size, (const u8*)vec[i].buf + done, chunk);
+            p += msgs[n].len;
+            n++;
+        }
     }
-    else if (fm24->devinfo->addr_size == 2)
+
+    trace_fm24_xfer_start(info->busnum, info->addr, vec[0].address, bytes, 0);
+    ret = fm24_transfer(adap, info, stats, msgs, n);
+    trace_fm24_xfer_end(info->busnum, info->addr, vec[0].address, bytes, 0, ret);
+    msleep(info->delay);
+out:
+    kfree(data);
+    kfree(msgs);
+    return ret;
+}
+
+/*
+ * CRC32 arithmetic for checksummed regions. The CRC is linear over GF(2):
+ * for two messages of equal length, crc(a) ^ crc(b) is the raw CRC (zero
+ * init, no final xor) of a ^ b. A write that changes bytes [o, e) of a
+ * region of n bytes therefore changes its CRC by the raw CRC of old ^ new
+ * over [o, e), followed by n - e zero bytes. Appending z zero bytes is a
+ * multiplication by x^(8z) modulo the CRC polynomial, done here in the
+ * reflected bit order crc32_le() uses, in O(log z).
+ */
+#define FM24_CRC_POLY       0xedb88320
+
+static u32 fm24_x2n[32];        /* x^(2^k) mod P */
+
+static u32 fm24_crc_mulmod(u32 a, u32 b)
+{
+    u32 m = 1U << 31;
+    u32 p = 0;
+
+    for (;;)
     {
-        msg.buf[0] = (address >> 8) & 0xFF;
-        msg.buf[1] = (address & 0xFF);
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ FM24_CRC_POLY : b >> 1;
     }
-    else
+    return p;
+}
+
+static void fm24_crc_init(void)
+{
+    u32 p = 1U << 30;           /* x^1 */
+    int k = 0;
+
+    fm24_x2n[0] = p;
+    for (k = 1; k < 32; k++)
     {
-        printk(KERN_ERR "fm24 memroy address is error.\n");
-        ret = -EINVAL;
-        goto out;
+        fm24_x2n[k] = p = fm24_crc_mulmod(p, p);
     }
-    if (copy_from_user(msg.buf + fm24->devinfo->addr_size, buf, len))
+}
+
+/* raw crc followed by zeros zero bytes */
+static u32 fm24_crc_shift(u32 crc, size_t zeros)
+{
+    u32 p = 1U << 31;           /* x^0 */
+    int k = 3;                  /* 8 bits per byte */
+
+    for (; zeros; zeros >>= 1, k++)
     {
-        ret = -EFAULT;
-        goto out;
+        if (zeros & 1)
+            p = fm24_crc_mulmod(fm24_x2n[k & 31], p);
     }
-    ret = i2c_transfer(fm24->client.adapter, &msg, 1);
+    return fm24_crc_mulmod(p, crc);
+}
+
+static u32 fm24_crc(const u8* buf, size_t len)
+{
+    return ~crc32_le(~0, buf, len);
+}
+
+static int fm24_overlap(u32 a, size_t a_len, u32 b, size_t b_len)
+{
+    return a < b + b_len && b < a + a_len;
+}
+
+/* Must be called with chip->lock held. */
+static int fm24_region_read_crc(fm24_chip_t* chip, fm24_crc_region_t* r)
+{
+    __le32 crc;
+    int ret = 0;
+
+    if (r->cached)
+        return 0;
+    ret = __fm24_chip_read(chip->client->adapter, chip->info, &chip->stats, r->region.crc_at, &crc, sizeof(crc));
     if (ret < 0)
+        return ret;
+    r->crc = le32_to_cpu(crc);
+    r->cached = 1;
+    return 0;
+}
+
+/*
+ * Append to vec the CRC updates of the regions a write touches, to go out
+ * in the same transfer. The new CRCs are left in next and become the cached
+ * ones once the transfer succeeds. Must be called with chip->lock held.
+ */
+static int fm24_region_update(fm24_chip_t* chip, fm24_vec_t* vec, unsigned int* num,
+                              __le32* crcs, u32* next, u32* touched)
+{
+    unsigned int data_num = *num;
+    fm24_crc_region_t* r = NULL;
+    u8* old = NULL;
+    const u8* new = NULL;
+    u32 start = 0, end = 0, region_end = 0;
+    unsigned int i = 0, v = 0, j = 0;
+    int ret = 0;
+
+    *touched = 0;
+    for (i = 0; i < FM24_REGION_MAX; i++)
     {
+        r = chip->regions + i;
+        if (!r->region.len)
+            continue;
+        region_end = r->region.base + r->region.len;
+        for (v = 0; v < data_num; v++)
+        {
+            if (fm24_overlap(vec[v].address, vec[v].len, r->region.crc_at, sizeof(__le32)))
+                break;
+        }
+        if (v < data_num)
+        {
+            /* the caller writes the CRC itself */
+            r->cached = 0;
+            continue;
+        }
+
+        for (v = 0; v < data_num; v++)
+        {
+            start = max_t(u32, vec[v].address, r->region.base);
+            end = min_t(u32, vec[v].address + vec[v].len, region_end);
+            if (start >= end)
+                continue;
+            if (!(*touched & (1 << i)))
+            {
+                if ((ret = fm24_region_read_crc(chip, r)) < 0)
+                    goto out;
+                next[i] = r->crc;
+                *touched |= 1 << i;
+            }
+            if (!old && !(old = kmalloc(chip->info->chip_size, GFP_KERNEL)))
+            {
+                ret = -ENOMEM;
+                goto out;
+            }
+            ret = __fm24_chip_read(chip->client->adapter, chip->info, &chip->stats, start, old, end - start);
+            if (ret < 0)
+                goto out;
+            new = (const u8*)vec[v].buf + (start - vec[v].address);
+            for (j = 0; j < end - start; j++)
+            {
+                old[j] ^= new[j];
+            }
+            next[i] ^= fm24_crc_shift(crc32_le(0, old, end - start), region_end - end);
+        }
+        if (*touched & (1 << i))
+        {
+            crcs[i] = cpu_to_le32(next[i]);
+            vec[*num].address = r->region.crc_at;
+            vec[*num].buf = crcs + i;
+            vec[*num].len = sizeof(__le32);
+            (*num)++;
+        }
+    }
+out:
+    kfree(old);
+    return ret;
+}
+
+static int fm24_chip_write_vec(fm24_chip_t* chip, const fm24_vec_t* vec, unsigned int num)
+{
+    fm24_vec_t all[FM24_VEC_MAX + FM24_REGION_MAX];
+    __le32 crcs[FM24_REGION_MAX];
+    u32 next[FM24_REGION_MAX];
+    u32 touched = 0;
+    unsigned int i = 0, j = 0;
+    int ret = 0;
+
+    if (num == 0 || num > FM24_VEC_MAX)
+        return -EINVAL;
+    for (i = 0; i < num; i++)
+    {
+        if ((ret = fm24_check_range(chip->info, vec[i].address, vec[i].len)) < 0)
+            return ret;
+        /* CRC deltas are taken against the bytes on the chip before the write */
+        for (j = 0; j < i; j++)
+        {
+            if (fm24_overlap(vec[i].address, vec[i].len, vec[j].address, vec[j].len))
+                return -EINVAL;
+        }
+    }
+    memcpy(all, vec, num * sizeof(*vec));
+
+    mutex_lock(&chip->lock);
+    if (!chip->client)
+    {
+        ret = -ENODEV;
         goto out;
     }
-    ret = len;
+    if ((ret = fm24_region_update(chip, all, &num, crcs, next, &touched)) < 0)
+        goto out;
+    ret = __fm24_chip_write_vec(chip->client->adapter, chip->info, &chip->stats, all, num);
+    for (i = 0; i < FM24_REGION_MAX; i++)
+    {
+        if (!(touched & (1 << i)))
+            continue;
+        /* after a failed transfer the stored CRC is unknown */
+        chip->regions[i].crc = next[i];
+        chip->regions[i].cached = ret == 0;
+    }
 out:
-    kfree(msg.buf);
+    mutex_unlock(&chip->lock);
+    return ret;
+}
+
+ssize_t fm24_chip_size(unsigned int minor)
+{
+    fm24_chip_t* chip = fm24_chip_get(minor);
+    ssize_t ret = 0;
+
+    if (!chip)
+        return -ENODEV;
+    ret = chip->info->chip_size;
+    fm24_chip_put(chip);
     return ret;
 }
+EXPORT_SYMBOL_GPL(fm24_chip_size);
 
-static int fm24_i2c_read(fm24_client_t* fm24, uint32_t address, char __user* buf, size_t len)
+int fm24_read_buf(unsigned int minor, u32 address, void* buf, size_t len)
 {
+    fm24_chip_t* chip = fm24_chip_get(minor);
     int ret = 0;
-    struct i2c_msg msgs[2];
-    msgs[0].buf = (uint8_t*)kzalloc(fm24->devinfo->addr_size, sizeof(uint8_t));
-    if (fm24->devinfo->addr_size == 1)
-        msgs[0].buf[0] = address & 0xFF;
-    else if (fm24->devinfo->addr_size == 2)
+
+    if (!chip)
+        return -ENODEV;
+    ret = fm24_chip_read(chip, address, buf, len);
+    fm24_chip_put(chip);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(fm24_read_buf);
+
+int fm24_write_vec(unsigned int minor, const fm24_vec_t* vec, unsigned int num)
+{
+    fm24_chip_t* chip = fm24_chip_get(minor);
+    int ret = 0;
+
+    if (!chip)
+        return -ENODEV;
+    ret = fm24_chip_write_vec(chip, vec, num);
+    fm24_chip_put(chip);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(fm24_write_vec);
+
+/* Must be called with chip->lock held. */
+static int fm24_region_verify(fm24_chip_t* chip, fm24_crc_region_t* r, fm24_verify_t* verify)
+{
+    u8* data = NULL;
+    int ret = 0;
+
+    data = kmalloc(r->region.len, GFP_KERNEL);
+    if (!data)
+        return -ENOMEM;
+    ret = __fm24_chip_read(chip->client->adapter, chip->info, &chip->stats, r->region.base, data, r->region.len);
+    r->cached = 0;
+    if (ret == 0)
+        ret = fm24_region_read_crc(chip, r);
+    if (ret == 0)
     {
-        msgs[0].buf[0] = (address >> 8) & 0xFF;
-        msgs[0].buf[1] = address & 0xFF;
+        verify->stored = r->crc;
+        verify->computed = fm24_crc(data, r->region.len);
+        verify->ok = verify->stored == verify->computed;
     }
-    else
+    kfree(data);
+    return ret;
+}
+
+/*
+ * A CRC must not sit inside any other region, or in the CRC bytes of
+ * another one: writes maintaining one region would then corrupt the other.
+ * Must be called with chip->lock held.
+ */
+static int fm24_region_conflict(fm24_chip_t* chip, const fm24_region_t* region)
+{
+    const fm24_region_t* other = NULL;
+    unsigned int i = 0;
+
+    for (i = 0; i < FM24_REGION_MAX; i++)
     {
-        printk(KERN_INFO "fm24 memory address is error.\n");
-        kfree(msgs[0].buf);
+        other = &chip->regions[i].region;
+        if (i == region->id || !other->len)
+            continue;
+        if (fm24_overlap(other->base, other->len, region->crc_at, sizeof(__le32)) ||
+            fm24_overlap(region->base, region->len, other->crc_at, sizeof(__le32)) ||
+            fm24_overlap(region->crc_at, sizeof(__le32), other->crc_at, sizeof(__le32)))
+            return 1;
+    }
+    return 0;
+}
+
+static int fm24_region_set(fm24_chip_t* chip, const fm24_region_t* region)
+{
+    const fm24_devinfo_t* info = chip->info;
+    fm24_crc_region_t* r = NULL;
+    fm24_verify_t verify;
+    fm24_vec_t vec;
+    __le32 crc;
+    int ret = 0;
+
+    if (region->id >= FM24_REGION_MAX)
+        return -EINVAL;
+    if (region->len && (fm24_check_range(info, region->base, region->len) < 0 ||
+                        fm24_check_range(info, region->crc_at, sizeof(crc)) < 0 ||
+                        fm24_overlap(region->base, region->len, region->crc_at, sizeof(crc))))
+        return -EINVAL;
+
+    mutex_lock(&chip->lock);
+    if (region->len && fm24_region_conflict(chip, region))
+    {
+        mutex_unlock(&chip->lock);
         return -EINVAL;
     }
-    
-    msgs[0].len = fm24->devinfo->addr_size;
-    msgs[0].addr = fm24->devinfo->addr;
-    msgs[0].flags = 0;
-    msgs[1].buf = kzalloc(len, sizeof(uint8_t));
-    if (copy_from_user(msgs[1].buf, buf, len))
+    r = chip->regions + region->id;
+    memset(r, 0, sizeof(*r));
+    if (!region->len)
+        goto out;
+    if (!chip->client)
     {
-        ret = -EFAULT;
+        ret = -ENODEV;
+        goto out;
+    }
+    r->region = *region;
+    r->region.flags = 0;
+    if (!(region->flags & FM24_REGION_SEAL))
+    {
+        ret = fm24_region_read_crc(chip, r);
         goto out;
     }
-    
-    msgs[1].addr = fm24->devinfo->addr;
-    msgs[1].flags = I2C_M_RD;
-    msgs[1].len = len;
-    ret = i2c_transfer(fm24->client.adapter, msgs, 2);
-    if (ret > 0)
+    if ((ret = fm24_region_verify(chip, r, &verify)) < 0)
+        goto out;
+    crc = cpu_to_le32(verify.computed);
+    vec.address = region->crc_at;
+    vec.buf = &crc;
+    vec.len = sizeof(crc);
+    ret = __fm24_chip_write_vec(chip->client->adapter, info, &chip->stats, &vec, 1);
+    r->crc = verify.computed;
+    r->cached = ret == 0;
+out:
+    if (ret < 0)
+        memset(r, 0, sizeof(*r));
+    mutex_unlock(&chip->lock);
+    return ret;
+}
+
+static long fm24_unlocked_ioctl(struct file* file, unsigned int cmd, unsigned long arg)
+{
+    fm24_chip_t* chip = file->private_data;
+    fm24_region_t region;
+    fm24_verify_t verify;
+    fm24_stats_t stats;
+    int ret = 0;
+
+    switch (cmd)
     {
-        if (copy_to_user(buf, msgs[1].buf, len))
+    case FM24_IOC_SET_REGION:
+        if (copy_from_user(&region, (void __user*)arg, sizeof(region)))
+            return -EFAULT;
+        ret = fm24_region_set(chip, &region);
+        break;
+    case FM24_IOC_GET_REGION:
+        if (copy_from_user(&region, (void __user*)arg, sizeof(region)))
+            return -EFAULT;
+        if (region.id >= FM24_REGION_MAX)
+            return -EINVAL;
+        mutex_lock(&chip->lock);
+        region = chip->regions[region.id].region;
+        mutex_unlock(&chip->lock);
+        if (copy_to_user((void __user*)arg, &region, sizeof(region)))
+            return -EFAULT;
+        break;
+    case FM24_IOC_GET_STATS:
+        mutex_lock(&chip->lock);
+        stats = chip->stats;
+        mutex_unlock(&chip->lock);
+        if (copy_to_user((void __user*)arg, &stats, sizeof(stats)))
+            return -EFAULT;
+        break;
+    case FM24_IOC_VERIFY:
+        if (copy_from_user(&verify, (void __user*)arg, sizeof(verify)))
+            return -EFAULT;
+        if (verify.id >= FM24_REGION_MAX)
+            return -EINVAL;
+        mutex_lock(&chip->lock);
+        if (!chip->client)
+            ret = -ENODEV;
+        else if (!chip->regions[verify.id].region.len)
+            ret = -ENOENT;
+        else
+            ret = fm24_region_verify(chip, chip->regions + verify.id, &verify);
+        mutex_unlock(&chip->lock);
+        if (ret == 0 && copy_to_user((void __user*)arg, &verify, sizeof(verify)))
+            return -EFAULT;
+        break;
+    default:
+        ret = -ENOTTY;
+    }
+    return ret;
+}
+
+/* Declare the regions= module parameters and verify them. */
+static void fm24_regions_load(void)
+{
+    fm24_chip_t* chip = NULL;
+    fm24_region_t region;
+    fm24_verify_t verify;
+    unsigned int minor = 0;
+    int ids[FM24_CHIPS];
+    int i = 0, ret = 0;
+
+    memset(ids, 0, sizeof(ids));
+    for (i = 0; i < regions_num; i++)
+    {
+        memset(&region, 0, sizeof(region));
+        if (sscanf(regions[i], "%u:%u:%u:%u", &minor, &region.base, &region.len,
+                   &region.crc_at) != 4 || !region.len)
+        {
+            imx_warn("bad region \"%s\"\n", regions[i]);
+            continue;
+        }
+        if (!(chip = fm24_chip_get(minor)))
+        {
+            imx_warn("region \"%s\": chip %u is not bound\n", regions[i], minor);
+            continue;
+        }
+        region.id = ids[minor]++;
+        if ((ret = fm24_region_set(chip, &region)) == 0)
         {
-            ret = -EFAULT;
-            goto out;
+            mutex_lock(&chip->lock);
+            ret = chip->client ? fm24_region_verify(chip, chip->regions + region.id, &verify) : -ENODEV;
+            mutex_unlock(&chip->lock);
         }
+        if (ret < 0)
+            imx_warn("region \"%s\": %d\n", regions[i], ret);
+        else if (!verify.ok)
+            imx_warn("region \"%s\": CRC mismatch, stored %08x computed %08x\n",
+                     regions[i], verify.stored, verify.computed);
+        fm24_chip_put(chip);
     }
-    return len;
+}
 
-out:
-    kfree(msgs[0].buf);
-    kfree(msgs[1].buf);
-    return ret;
+
+static int fm24_open(struct inode* inode, struct file* file)
+{
+    fm24_chip_t* chip = fm24_chip_get(iminor(inode));
+
+    imx_dbg("fm24 open minor=%d\n", iminor(inode));
+    if (!chip)
+        return -ENODEV;
+    file->private_data = chip;
+    return 0;
 }
 
-static loff_t fm24_llseek(struct file* file, loff_t offset, int whence)
+static int fm24_release(struct inode* inode, struct file* file)
+{
+    fm24_chip_put(file->private_data);
+    return 0;
+}
+
+static loff_t fm24_seek(struct file* file, loff_t offset, int whence, size_t size)
 {
-    printk(KERN_INFO "fm24 llseek: offset=%d, whence=%d\n", (int)offset, (int)whence);
-    fm24_client_t* fm24 = file->private_data;
     loff_t ret = 0;
+
+    imx_dbg("fm24 llseek: offset=%d, whence=%d\n", (int)offset, (int)whence);
     switch(whence)
     {
     case SEEK_SET:
-        printk(KERN_INFO "[SET][%d] offset is %d\n", whence, (int)offset);
-        if (offset < 0 || offset >= fm24->devinfo->chip_size)
+        if (offset < 0 || offset >= size)
         {
             ret = -EINVAL;
             break;
@@ -197,8 +862,7 @@ static loff_t fm24_llseek(struct file* file, loff_t offset, int whence)
         ret = file->f_pos;
         break;
     case SEEK_CUR:
-        printk(KERN_INFO "[CUR][%d] offset is %d\n", whence, (int)offset);
-        if (file->f_pos + offset <= 0 || file->f_pos + offset > fm24->devinfo->chip_size)
+        if (file->f_pos + offset <= 0 || file->f_pos + offset > size)
         {
             ret = -EINVAL;
             break;
@@ -207,8 +871,7 @@ static loff_t fm24_llseek(struct file* file, loff_t offset, int whence)
         ret = file->f_pos;
         break;
     case SEEK_END:
-        printk(KERN_INFO "[END][%d] offset is %d\n", whence, (int)offset);
-        if (file->f_pos + offset < 0 || file->f_pos + offset > fm24->devinfo->chip_size)
+        if (file->f_pos + offset < 0 || file->f_pos + offset > size)
         {
             ret = -EINVAL;
             break;
@@ -218,70 +881,75 @@ static loff_t fm24_llseek(struct file* file, loff_t offset, int whence)
     default:
         ret = -EINVAL;
     }
-    printk(KERN_INFO "llseek end.\n");
     return ret;
 }
 
+static loff_t fm24_llseek(struct file* file, loff_t offset, int whence)
+{
+    fm24_chip_t* chip = file->private_data;
+
+    return fm24_seek(file, offset, whence, chip->info->chip_size);
+}
+
 static ssize_t fm24_read(struct file* file, char __user* buf, size_t len, loff_t* offset)
 {
-    printk(KERN_INFO ">>>read %d bytes from %d\n", (int)len, (int)*offset);
-    fm24_client_t* fm24 = file->private_data;
+    fm24_chip_t* chip = file->private_data;
+    void* data = NULL;
+    ssize_t ret = 0;
 
-    int ret = len;
-    int result = 0;
-    fm24_devinfo_t* info = fm24->devinfo;
-    int rd_len = 0;
-    uint32_t dev_addr;
-    uint32_t address = *offset;
-    while (len)
-    {
-        dev_addr = ((address >> 8) & info->addr_mask) | info->addr;
+    imx_dbg("read %d bytes from %d\n", (int)len, (int)*offset);
+    if (*offset >= chip->info->chip_size)
+        return 0;
+    len = min_t(size_t, len, chip->info->chip_size - *offset);
+    data = kmalloc(len, GFP_KERNEL);
+    if (!data)
+        return -ENOMEM;
 
-        if ((address & (info->page_size - 1)) + len > info->page_size)
-            rd_len = info->page_size - (address & (info->page_size - 1));
-        else
-            rd_len = len;
-        
-        if ((result = fm24_i2c_read(fm24, address, buf, rd_len)) < 0)
-        {
-            return result;
-        }
-        len -= rd_len;
-        address += rd_len;
-        buf += rd_len;
+    ret = fm24_chip_read(chip, *offset, data, len);
+    if (ret < 0)
+        goto out;
+    if (copy_to_user(buf, data, len))
+    {
+        ret = -EFAULT;
+        goto out;
     }
-    *offset += ret;
+    *offset += len;
+    ret = len;
+out:
+    kfree(data);
     return ret;
 }
 
 static ssize_t fm24_write(struct file* file, const char __user* buf, size_t len, loff_t* offset)
 {
-    printk(KERN_INFO "write %d bytes to %d\n", (int)len, (int)*offset);
-    fm24_client_t* fm24 = file->private_data;
-    fm24_devinfo_t* info = fm24->devinfo;
-    int result = 0;
-    int wr_len = 0;
-    uint32_t dev_addr;
-    uint32_t address = *offset;
-    int ret = len;
+    fm24_chip_t* chip = file->private_data;
+    fm24_vec_t vec;
+    void* data = NULL;
+    ssize_t ret = 0;
 
-    while (len)
+    imx_dbg("write %d bytes to %d\n", (int)len, (int)*offset);
+    if (*offset >= chip->info->chip_size)
+        return len ? -ENOSPC : 0;
+    len = min_t(size_t, len, chip->info->chip_size - *offset);
+    data = kmalloc(len, GFP_KERNEL);
+    if (!data)
+        return -ENOMEM;
+    if (copy_from_user(data, buf, len))
     {
-        dev_addr = ((address >> 8) & info->addr_mask) | info->addr;
+        ret = -EFAULT;
+        goto out;
+    }
 
-        if ((address & (info->page_size - 1)) + len > info->page_size)
-            wr_len = info->page_size - (address & (info->page_size - 1));
-        else
-            wr_len = len;
-        
-        if ((result = fm24_i2c_write(fm24, address, buf, wr_len)) < 0)
-            return result;
-        len -= wr_len;
-        address += wr_len;
-        buf += wr_len;
-        mdelay(info->delay);
-    }
-    *offset += ret;
+    vec.address = *offset;
+    vec.buf = data;
+    vec.len = len;
+    ret = fm24_chip_write_vec(chip, &vec, 1);
+    if (ret < 0)
+        goto out;
+    *offset += len;
+    ret = len;
+out:
+    kfree(data);
     return ret;
 }
 
@@ -292,73 +960,514 @@ static const struct file_operations fm24_ops = {
     .llseek = fm24_llseek,
     .read = fm24_read,
     .write = fm24_write,
+    .unlocked_ioctl = fm24_unlocked_ioctl,
 };
 
+
+/* Member holding aggregate offset pos, its chip address and bytes left in the unit. */
+static unsigned int fm24_agg_map(const fm24_agg_t* agg, u32 pos, u32* address, size_t* avail)
+{
+    unsigned int m = 0;
+    u32 unit = 0;
+
+    if (agg->stripe)
+    {
+        unit = pos / agg->stripe;
+        m = unit % agg->members_num;
+        *address = unit / agg->members_num * agg->stripe + pos % agg->stripe;
+        *avail = agg->stripe - pos % agg->stripe;
+        return m;
+    }
+    for (m = 0; pos >= agg->members[m]->info->chip_size; m++)
+    {
+        pos -= agg->members[m]->info->chip_size;
+    }
+    *address = pos;
+    *avail = agg->members[m]->info->chip_size - pos;
+    return m;
+}
+
+/*
+ * The part of a request that falls on one member is a single run of chip
+ * addresses. Walk the request, copy that part between the request buffer
+ * and bounce, which holds the run from *start, and return its length. A
+ * NULL bounce only finds the run.
+ */
+static size_t fm24_agg_walk(fm24_agg_req_t* req, unsigned int m, u8* bounce, u32* start)
+{
+    const fm24_agg_t* agg = &fm24_dev.agg;
+    size_t done = 0, avail = 0, chunk = 0, span = 0;
+    u32 address = 0;
+
+    for (done = 0; done < req->len; done += chunk)
+    {
+        chunk = req->len - done;
+        if (fm24_agg_map(agg, req->pos + done, &address, &avail) != m)
+        {
+            chunk = min(chunk, avail);
+            continue;
+        }
+        chunk = min(chunk, avail);
+        if (!span)
+            *start = address;
+        span = address + chunk - *start;
+        if (!bounce)
+            continue;
+        if (req->write)
+            memcpy(bounce + address - *start, req->buf + done, chunk);
+        else
+            memcpy(req->buf + done, bounce + address - *start, chunk);
+    }
+    return span;
+}
+
+/* One transfer per member on this job's bus. */
+static void fm24_agg_work(struct work_struct* work)
+{
+    fm24_agg_job_t* job = container_of(work, fm24_agg_job_t, work);
+    fm24_agg_req_t* req = job->req;
+    const fm24_agg_t* agg = &fm24_dev.agg;
+    u8* bounce = NULL;
+    fm24_vec_t vec;
+    unsigned int m = 0;
+    size_t span = 0;
+    u32 start = 0;
+
+    for (m = 0; m < agg->members_num && job->ret == 0; m++)
+    {
+        if (agg->bus_of[m] != job->bus)
+            continue;
+        if ((span = fm24_agg_walk(req, m, NULL, &start)) == 0)
+            continue;
+        if (!bounce && !(bounce = kmalloc(agg->chip_max, GFP_KERNEL)))
+        {
+            job->ret = -ENOMEM;
+            break;
+        }
+        if (req->write)
+        {
+            fm24_agg_walk(req, m, bounce, &start);
+            vec.address = start;
+            vec.buf = bounce;
+            vec.len = span;
+            job->ret = fm24_chip_write_vec(agg->members[m], &vec, 1);
+        }
+        else if ((job->ret = fm24_chip_read(agg->members[m], start, bounce, span)) == 0)
+        {
+            fm24_agg_walk(req, m, bounce, &start);
+        }
+    }
+    kfree(bounce);
+    if (atomic_dec_and_test(&req->pending))
+        complete(&req->done);
+}
+
+static int fm24_agg_xfer(u32 pos, u8* buf, size_t len, int write)
+{
+    fm24_agg_t* agg = &fm24_dev.agg;
+    fm24_agg_req_t* req = NULL;
+    unsigned int b = 0;
+    int ret = 0;
+
+    req = kzalloc(sizeof(*req), GFP_KERNEL);
+    if (!req)
+        return -ENOMEM;
+    req->pos = pos;
+    req->buf = buf;
+    req->len = len;
+    req->write = write;
+    atomic_set(&req->pending, agg->buses_num);
+    init_completion(&req->done);
+    for (b = 0; b < agg->buses_num; b++)
+    {
+        req->jobs[b].req = req;
+        req->jobs[b].bus = b;
+        INIT_WORK(&req->jobs[b].work, fm24_agg_work);
+        queue_work(agg->buses[b].wq, &req->jobs[b].work);
+    }
+    wait_for_completion(&req->done);
+
+    for (b = 0; b < agg->buses_num && ret == 0; b++)
+    {
+        ret = req->jobs[b].ret;
+    }
+    kfree(req);
+    return ret;
+}
+
+static loff_t fm24_agg_llseek(struct file* file, loff_t offset, int whence)
+{
+    return fm24_seek(file, offset, whence, fm24_dev.agg.size);
+}
+
+static ssize_t fm24_agg_read(struct file* file, char __user* buf, size_t len, loff_t* offset)
+{
+    size_t size = fm24_dev.agg.size;
+    void* data = NULL;
+    ssize_t ret = 0;
+
+    if (*offset >= size)
+        return 0;
+    len = min_t(size_t, len, size - *offset);
+    data = kmalloc(len, GFP_KERNEL);
+    if (!data)
+        return -ENOMEM;
+
+    ret = fm24_agg_xfer(*offset, data, len, 0);
+    if (ret < 0)
+        goto out;
+    if (copy_to_user(buf, data, len))
+    {
+        ret = -EFAULT;
+        goto out;
+    }
+    *offset += len;
+    ret = len;
+out:
+    kfree(data);
+    return ret;
+}
+
+static ssize_t fm24_agg_write(struct file* file, const char __user* buf, size_t len, loff_t* offset)
+{
+    size_t size = fm24_dev.agg.size;
+    void* data = NULL;
+    ssize_t ret = 0;
+
+    if (*offset >= size)
+        return len ? -ENOSPC : 0;
+    len = min_t(size_t, len, size - *offset);
+    data = kmalloc(len, GFP_KERNEL);
+    if (!data)
+        return -ENOMEM;
+    if (copy_from_user(data, buf, len))
+    {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    ret = fm24_agg_xfer(*offset, data, len, 1);
+    if (ret < 0)
+        goto out;
+    *offset += len;
+    ret = len;
+out:
+    kfree(data);
+    return ret;
+}
+
+static const struct file_operations fm24_agg_ops = {
+    .owner = THIS_MODULE,
+    .llseek = fm24_agg_llseek,
+    .read = fm24_agg_read,
+    .write = fm24_agg_write,
+};
+
+static void fm24_agg_deinit(void)
+{
+    fm24_agg_t* agg = &fm24_dev.agg;
+    unsigned int i = 0;
+
+    if (agg->size)
+    {
+        device_destroy(fm24_dev.class, MKDEV(MAJOR(fm24_dev.devno), FM24_AGG_MINOR));
+        cdev_del(&agg->cdev);
+    }
+    for (i = 0; i < agg->buses_num; i++)
+    {
+        destroy_workqueue(agg->buses[i].wq);
+    }
+    for (i = 0; i < agg->members_num; i++)
+    {
+        fm24_chip_put(agg->members[i]);
+    }
+    memset(agg, 0, sizeof(*agg));
+}
+
+/* Set up /dev/fm24agg from the aggregate and stripe parameters, if given. */
+static int fm24_agg_init(void)
+{
+    fm24_agg_t* agg = &fm24_dev.agg;
+    fm24_chip_t* chip = NULL;
+    struct device* dev = NULL;
+    size_t chip_min = 0;
+    unsigned int i = 0, j = 0, b = 0;
+    int ret = 0;
+
+    if (aggregate_num == 0)
+        return 0;
+    agg->stripe = stripe;
+
+    for (i = 0; i < aggregate_num; i++)
+    {
+        for (j = 0; j < i; j++)
+        {
+            if (aggregate[j] == aggregate[i])
+            {
+                imx_err("aggregate member %d given twice\n", aggregate[i]);
+                ret = -EINVAL;
+                goto fail;
+            }
+        }
+        if (!(chip = fm24_chip_get(aggregate[i])))
+        {
+            imx_err("aggregate member %d is not bound\n", aggregate[i]);
+            ret = -ENODEV;
+            goto fail;
+        }
+        agg->members[agg->members_num++] = chip;
+        for (b = 0; b < agg->buses_num && agg->buses[b].busnum != chip->info->busnum; b++)
+            ;
+        if (b == agg->buses_num)
+        {
+            agg->buses[b].busnum = chip->info->busnum;
+            snprintf(agg->buses[b].name, sizeof(agg->buses[b].name), "fm24-i2c-%d",
+                     chip->info->busnum);
+            agg->buses[b].wq = create_singlethread_workqueue(agg->buses[b].name);
+            if (!agg->buses[b].wq)
+            {
+                ret = -ENOMEM;
+                goto fail;
+            }
+            agg->buses_num++;
+        }
+        agg->bus_of[i] = b;
+        agg->chip_max = max(agg->chip_max, chip->info->chip_size);
+        chip_min = i ? min(chip_min, chip->info->chip_size) : chip->info->chip_size;
+    }
+
+    if (agg->stripe)
+    {
+        if (agg->stripe > chip_min)
+        {
+            imx_err("stripe %u is larger than a member\n", stripe);
+            ret = -EINVAL;
+            goto fail;
+        }
+        agg->size = chip_min / agg->stripe * agg->stripe * agg->members_num;
+    }
+    else
+    {
+        for (i = 0; i < agg->members_num; i++)
+        {
+            agg->size += agg->members[i]->info->chip_size;
+        }
+    }
+
+    cdev_init(&agg->cdev, &fm24_agg_ops);
+    if ((ret = cdev_add(&agg->cdev, MKDEV(MAJOR(fm24_dev.devno), FM24_AGG_MINOR), 1)) < 0)
+    {
+        agg->size = 0;
+        goto fail;
+    }
+    dev = device_create(fm24_dev.class, NULL, MKDEV(MAJOR(fm24_dev.devno), FM24_AGG_MINOR),
+                        NULL, "fm24agg");
+    if (IS_ERR(dev))
+        imx_warn("fm24agg device node not created: %ld\n", PTR_ERR(dev));
+    imx_info("fm24agg: %u chips on %u buses, %zu bytes, stripe %zu\n",
+             agg->members_num, agg->buses_num, agg->size, agg->stripe);
+    return 0;
+
+fail:
+    fm24_agg_deinit();
+    return ret;
+}
+
+
+static int fm24_lookup(struct i2c_client* client)
+{
+    int i = 0;
+
+    for (i = 0; i < FM24_CHIPS; i++)
+    {
+        if (fm24_devinfos[i].busnum == i2c_adapter_id(client->adapter) &&
+            fm24_devinfos[i].addr == client->addr)
+            return i;
+    }
+    return -1;
+}
+
+static int fm24_probe(struct i2c_client* client)
+{
+    int minor = fm24_lookup(client);
+    const fm24_devinfo_t* info = NULL;
+    fm24_chip_t* chip = NULL;
+    struct device* dev = NULL;
+    u8 byte = 0;
+    int ret = 0;
+
+    if (minor < 0)
+        return -ENODEV;
+    info = fm24_devinfos + minor;
+
+    /* the chip must answer before a node is created for it */
+    if ((ret = __fm24_chip_read(client->adapter, info, NULL, 0, &byte, 1)) < 0)
+    {
+        imx_info("%s on i2c-%d at 0x%02x not responding: %d\n",
+                 info->name, info->busnum, info->addr, ret);
+        return -ENODEV;
+    }
+
+    chip = kzalloc(sizeof(*chip), GFP_KERNEL);
+    if (!chip)
+        return -ENOMEM;
+    kref_init(&chip->ref);
+    mutex_init(&chip->lock);
+    chip->client = client;
+    chip->info = info;
+    chip->minor = minor;
+
+    mutex_lock(&fm24_dev.lock);
+    if (fm24_dev.chips[minor])
+        ret = -EBUSY;
+    else
+        fm24_dev.chips[minor] = chip;
+    mutex_unlock(&fm24_dev.lock);
+    if (ret < 0)
+    {
+        kfree(chip);
+        return ret;
+    }
+    i2c_set_clientdata(client, chip);
+
+    dev = device_create(fm24_dev.class, &client->dev, MKDEV(MAJOR(fm24_dev.devno), minor),
+                        NULL, "%s", info->name);
+    if (IS_ERR(dev))
+        imx_warn("%s device node not created: %ld\n", info->name, PTR_ERR(dev));
+    imx_info("%s bound on i2c-%d at 0x%02x\n", info->name, info->busnum, info->addr);
+    return 0;
+}
+IMX_I2C_PROBE(fm24_probe)
+
+static void fm24_remove(struct i2c_client* client)
+{
+    fm24_chip_t* chip = i2c_get_clientdata(client);
+
+    device_destroy(fm24_dev.class, MKDEV(MAJOR(fm24_dev.devno), chip->minor));
+    mutex_lock(&fm24_dev.lock);
+    fm24_dev.chips[chip->minor] = NULL;
+    mutex_unlock(&fm24_dev.lock);
+
+    mutex_lock(&chip->lock);
+    chip->client = NULL;
+    mutex_unlock(&chip->lock);
+    fm24_chip_put(chip);
+}
+IMX_I2C_REMOVE(fm24_remove)
+
+static const struct i2c_device_id fm24_ids[] = {
+    {FM24_DEV_NAME, 0},
+    {},
+};
+MODULE_DEVICE_TABLE(i2c, fm24_ids);
+
 static struct i2c_driver fm24_driver = {
     .driver = {
         .name = "fm24",
         .owner = THIS_MODULE,
     },
+    .probe = fm24_probe_compat,
+    .remove = fm24_remove_compat,
+    .id_table = fm24_ids,
 };
 
+/*
+ * Instantiate one chip; probing it checks that it answers. Chips on
+ * different buses are bound in parallel, so load time does not grow with
+ * the number of absent or slow chips.
+ */
+static void fm24_bind_async(void* data, async_cookie_t cookie)
+{
+    unsigned int minor = (unsigned long)data;
+    const fm24_devinfo_t* info = fm24_devinfos + minor;
+    struct i2c_board_info board;
+    struct i2c_adapter* adap = NULL;
+    struct i2c_client* client = NULL;
+
+    adap = i2c_get_adapter(info->busnum);
+    if (!adap)
+    {
+        imx_warn("%s: no adapter i2c-%d\n", info->name, info->busnum);
+        return;
+    }
+    memset(&board, 0, sizeof(board));
+    snprintf(board.type, sizeof(board.type), "%s", info->name);
+    board.addr = info->addr;
+    client = i2c_new_client_device(adap, &board);
+    i2c_put_adapter(adap);
+
+    /* -EBUSY: the board code declared the chip and it was probed already */
+    if (IS_ERR(client))
+    {
+        if (PTR_ERR(client) != -EBUSY)
+            imx_warn("%s: new device failed: %ld\n", info->name, PTR_ERR(client));
+        return;
+    }
+    fm24_dev.clients[minor] = client;
+}
+
 
 static int __init fm24cxx_init(void)
 {
     int ret = 0;
-    int major = 0;
-    int count = 0;
-    struct device* dev;
+    int bound = 0;
     int i = 0;
 
-    printk(KERN_INFO "FM24 chip driver\n");
-
-    ret = alloc_chrdev_region(&fm24_dev.devno, 0, ARRAY_SIZE(fm24_devinfos), FM24_DEV_NAME);
+    mutex_init(&fm24_dev.lock);
+    fm24_crc_init();
+    ret = alloc_chrdev_region(&fm24_dev.devno, 0, FM24_MINORS, FM24_DEV_NAME);
     if (ret < 0)
     {
-        printk(KERN_ERR "alloc FM24 chip driver cdev failed.\n");
+        imx_err("alloc FM24 chip driver cdev failed.\n");
         return ret;
     }
-    printk(KERN_INFO "major devno is %d\n", MAJOR(fm24_dev.devno));
+    imx_info("FM24 chip driver, major devno is %d\n", MAJOR(fm24_dev.devno));
 
-    major = MAJOR(fm24_dev.devno);
-    fm24_dev.class = class_create(THIS_MODULE, FM24_DEV_NAME);
-    if (!fm24_dev.class)
+    fm24_dev.class = imx_class_create(THIS_MODULE, FM24_DEV_NAME);
+    if (IS_ERR(fm24_dev.class))
     {
-        printk(KERN_INFO "class create failed.\n");
-        ret = -EBUSY;
+        imx_err("class create failed.\n");
+        ret = PTR_ERR(fm24_dev.class);
         goto fail0;
     }
 
-
     cdev_init(&fm24_dev.cdev, &fm24_ops);
-    if ((ret = cdev_add(&fm24_dev.cdev, MKDEV(major, 0), ARRAY_SIZE(fm24_devinfos))) < 0)
+    if ((ret = cdev_add(&fm24_dev.cdev, fm24_dev.devno, FM24_CHIPS)) < 0)
     {
-        printk(KERN_INFO "cdev add failed.\n");
+        imx_err("cdev add failed.\n");
         goto fail1;
     }
-    
+
     ret = i2c_add_driver(&fm24_driver);
     if (ret < 0)
     {
-        printk(KERN_ERR "fm24 i2c driver add failed.\n");
+        imx_err("fm24 i2c driver add failed.\n");
         goto fail2;
     }
 
-    for (i = 0; i < ARRAY_SIZE(fm24_devinfos); i++)
+    for (i = 0; i < FM24_CHIPS; i++)
     {
-        dev = device_create(fm24_dev.class, NULL, MKDEV(major, i), NULL, fm24_devinfos[i].name);
-        if (IS_ERR(dev))
-        {
-            ret = PTR_ERR(dev);
-            goto fail3;
-        }
+        async_schedule(fm24_bind_async, (void*)(unsigned long)i);
+    }
+    async_synchronize_full();
+
+    for (i = 0; i < FM24_CHIPS; i++)
+    {
+        if (fm24_dev.chips[i])
+            bound++;
     }
+    imx_info("%d of %d chips bound\n", bound, (int)FM24_CHIPS);
+    fm24_regions_load();
 
+    if ((ret = fm24_agg_init()) < 0)
+        goto fail3;
     return 0;
+
 fail3:
-    while (count--)
+    for (i = 0; i < FM24_CHIPS; i++)
     {
-        device_destroy(fm24_dev.class, MKDEV(major, count));
+        if (fm24_dev.clients[i])
+            i2c_unregister_device(fm24_dev.clients[i]);
     }
     i2c_del_driver(&fm24_driver);
 fail2:
@@ -366,24 +1475,26 @@ fail2:
 fail1:
     class_destroy(fm24_dev.class);
 fail0:
-    unregister_chrdev_region(fm24_dev.devno, 1);
+    unregister_chrdev_region(fm24_dev.devno, FM24_MINORS);
     return ret;
-
 }
 
 
 static void __exit fm24cxx_exit(void)
 {
     int i = 0;
-    int major = MAJOR(fm24_dev.devno);
-    for (i = 0; i < ARRAY_SIZE(fm24_devinfos); i++)
+
+    fm24_agg_deinit();
+    for (i = 0; i < FM24_CHIPS; i++)
     {
-        device_destroy(fm24_dev.class, MKDEV(major, i));
+        if (fm24_dev.clients[i])
+            i2c_unregister_device(fm24_dev.clients[i]);
     }
+    /* unbinds chips declared by board code */
     i2c_del_driver(&fm24_driver);
     cdev_del(&fm24_dev.cdev);
     class_destroy(fm24_dev.class);
-    unregister_chrdev_region(fm24_dev.devno, ARRAY_SIZE(fm24_devinfos));
+    unregister_chrdev_region(fm24_dev.devno, FM24_MINORS);
 }
 
 module_init(fm24cxx_init);
@@ -391,4 +1502,4 @@ module_exit(fm24cxx_exit);
 
 MODULE_AUTHOR("Arno");
 MODULE_LICENSE("Dual BSD/GPL");
-MODULE_DESCRIPTION("FM24CXX Chip driver.");
\ No newline at end of file
+MODULE_DESCRIPTION("FM24CXX Chip driver.");
@@ -0,0 +1,144 @@
+#ifndef __IMX28_COMPAT_H__
+#define __IMX28_COMPAT_H__
+
+/*
+ * The drivers are written against the i.MX28 BSP kernel (2.6.35) but are
+ * also built against the running host kernel so they can be exercised on
+ * gpio-mockup lines. Only the handful of APIs that changed in between are
+ * wrapped here; drivers use the newer names.
+ */
+
+#include <linux/version.h>
+#include <linux/compiler.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/device.h>
+#include <linux/i2c.h>
+#include <linux/err.h>
+#include <linux/delay.h>
+
+#ifndef IRQF_DISABLED
+#define IRQF_DISABLED               0
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 39)
+#define irq_set_irq_type(irq, type) set_irq_type(irq, type)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
+#define timer_setup(timer, callback, flags) \
+    setup_timer(timer, (void (*)(unsigned long))(callback), (unsigned long)(timer))
+#define from_timer(var, callback_timer, timer_fieldname) \
+    container_of(callback_timer, typeof(*var), timer_fieldname)
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+#define del_timer(timer)            timer_delete(timer)
+#define del_timer_sync(timer)       timer_delete_sync(timer)
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 16, 0)
+#define from_timer(var, callback_timer, timer_fieldname) \
+    timer_container_of(var, callback_timer, timer_fieldname)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static inline void hrtimer_setup(struct hrtimer* timer,
+                                 enum hrtimer_restart (*function)(struct hrtimer*),
+                                 clockid_t clock_id, enum hrtimer_mode mode)
+{
+    hrtimer_init(timer, clock_id, mode);
+    timer->function = function;
+}
+#endif
+
+/* no hrtimer backed sleeps yet, fall back to the nearest msleep() */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+#define usleep_range(min, max)      msleep(DIV_ROUND_UP(min, 1000))
+#endif
+
+/* 3.19 replaced ACCESS_ONCE() with READ_ONCE()/WRITE_ONCE() */
+#ifndef WRITE_ONCE
+#define WRITE_ONCE(x, val)          (*(volatile typeof(x)*)&(x) = (val))
+#endif
+
+/*
+ * I2C bus recovery (clocking out a stuck slave) exists since 3.10. It
+ * drives SCL/SDA directly, so the root adapter is locked around it to keep
+ * other clients' transfers off the bus; adapter drivers get the same from
+ * their xfer path.
+ */
+static inline int imx_i2c_recover_bus(struct i2c_adapter* adap)
+{
+    int ret = -EOPNOTSUPP;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+    if (adap->bus_recovery_info)
+    {
+        i2c_lock_bus(adap, I2C_LOCK_ROOT_ADAPTER);
+        ret = i2c_recover_bus(adap);
+        i2c_unlock_bus(adap, I2C_LOCK_ROOT_ADAPTER);
+    }
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3, 10, 0)
+    if (adap->bus_recovery_info)
+    {
+        i2c_lock_adapter(adap);
+        ret = i2c_recover_bus(adap);
+        i2c_unlock_adapter(adap);
+    }
+#endif
+    return ret;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+#define imx_class_create(owner, name)   class_create(name)
+#else
+#define imx_class_create(owner, name)   class_create(owner, name)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
+static inline struct i2c_client* i2c_new_client_device(struct i2c_adapter* adap,
+                                                       struct i2c_board_info const* info)
+{
+    struct i2c_client* client = i2c_new_device(adap, info);
+    return client ? client : ERR_PTR(-ENODEV);
+}
+#endif
+
+/*
+ * i2c_driver callbacks: probe lost its i2c_device_id argument in 6.3 and
+ * remove returns void since 6.1. Drivers write fn(client) and hook up the
+ * fn##_compat wrapper these generate.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+#define IMX_I2C_PROBE(fn) \
+    static int fn##_compat(struct i2c_client* client, const struct i2c_device_id* id) \
+    { \
+        return fn(client); \
+    }
+#else
+#define IMX_I2C_PROBE(fn) \
+    static int fn##_compat(struct i2c_client* client) \
+    { \
+        return fn(client); \
+    }
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
+#define IMX_I2C_REMOVE(fn) \
+    static int fn##_compat(struct i2c_client* client) \
+    { \
+        fn(client); \
+        return 0; \
+    }
+#else
+#define IMX_I2C_REMOVE(fn) \
+    static void fn##_compat(struct i2c_client* client) \
+    { \
+        fn(client); \
+    }
+#endif
+
+#endif /* __IMX28_COMPAT_H__ */
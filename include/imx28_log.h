@@ -0,0 +1,63 @@
+#ifndef __IMX28_LOG_H__
+#define __IMX28_LOG_H__
+
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/ratelimit.h>
+
+/*
+ * Logging shared by the imx28 drivers.
+ *
+ * Each module declares IMX_LOG_DEFINE() once, which adds a "debug"
+ * parameter writable at /sys/module/<module>/parameters/debug:
+ *   0 - errors and warnings only (default)
+ *   1 - also informational messages (probe, init, configuration)
+ *   2 - also hot path debug messages (IRQ, timers, I/O)
+ *
+ * Below its level imx_info()/imx_dbg() fall back to pr_debug(), so they
+ * cost a single branch and can still be enabled per call site through
+ * dynamic debug. Enabled messages and imx_err()/imx_warn() are rate
+ * limited per call site, since many of them come from IRQ or timer
+ * context. Drivers define pr_fmt() to prefix their module name.
+ */
+
+#define IMX_LOG_ERR                 0
+#define IMX_LOG_INFO                1
+#define IMX_LOG_DEBUG               2
+
+#define IMX_LOG_DEFINE()                                                    \
+    static int imx_log_level = IMX_LOG_ERR;                                 \
+    module_param_named(debug, imx_log_level, int, 0644);                    \
+    MODULE_PARM_DESC(debug, "log level: 0 errors, 1 info, 2 hot path debug")
+
+#define imx_log_ratelimited(level, fmt, ...)                                \
+    do {                                                                    \
+        static DEFINE_RATELIMIT_STATE(_imx_rs, DEFAULT_RATELIMIT_INTERVAL,  \
+                                      DEFAULT_RATELIMIT_BURST);             \
+        if (__ratelimit(&_imx_rs))                                          \
+            printk(level pr_fmt(fmt), ##__VA_ARGS__);                       \
+    } while (0)
+
+#define imx_err(fmt, ...)                                                   \
+    imx_log_ratelimited(KERN_ERR, fmt, ##__VA_ARGS__)
+
+#define imx_warn(fmt, ...)                                                  \
+    imx_log_ratelimited(KERN_WARNING, fmt, ##__VA_ARGS__)
+
+#define imx_info(fmt, ...)                                                  \
+    do {                                                                    \
+        if (unlikely(imx_log_level >= IMX_LOG_INFO))                        \
+            imx_log_ratelimited(KERN_INFO, fmt, ##__VA_ARGS__);             \
+        else                                                                \
+            pr_debug(fmt, ##__VA_ARGS__);                                   \
+    } while (0)
+
+#define imx_dbg(fmt, ...)                                                   \
+    do {                                                                    \
+        if (unlikely(imx_log_level >= IMX_LOG_DEBUG))                       \
+            imx_log_ratelimited(KERN_DEBUG, fmt, ##__VA_ARGS__);            \
+        else                                                                \
+            pr_debug(fmt, ##__VA_ARGS__);                                   \
+    } while (0)
+
+#endif /* __IMX28_LOG_H__ */
@@ -1,3 +1,5 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/input.h>
@@ -8,14 +10,34 @@
 #include <linux/irqreturn.h>
 #include <linux/interrupt.h>
 #include <linux/irq.h>
-#include "../arch/arm/mach-mx28/mx28_pins.h"
+#include <linux/ktime.h>
+#include <linux/device.h>
+#include "imx28_compat.h"
+#include "imx28_log.h"
+#define CREATE_TRACE_POINTS
+#include "imx_keys_trace.h"
 
+#ifdef CONFIG_ARCH_MX28
+#include "../arch/arm/mach-mx28/mx28_pins.h"
 
 #define BUTTON1_PIN                MXS_PIN_TO_GPIO(PINID_LCD_D17)
 #define BUTTON2_PIN                MXS_PIN_TO_GPIO(PINID_LCD_D18)
 #define BUTTON3_PIN                MXS_PIN_TO_GPIO(PINID_SSP0_DATA4)
 #define BUTTON4_PIN                MXS_PIN_TO_GPIO(PINID_SSP0_DATA5)
 #define BUTTON5_PIN                MXS_PIN_TO_GPIO(PINID_SSP0_DATA6)
+#else
+/* no default pins off the board, they must be given with gpios= */
+#define BUTTON1_PIN                -1
+#define BUTTON2_PIN                -1
+#define BUTTON3_PIN                -1
+#define BUTTON4_PIN                -1
+#define BUTTON5_PIN                -1
+#endif
+
+
+#define IMX_BUTTONS_MAX             64
+#define IMX_BUTTONS_SCAN            (HZ / 50)
+#define IMX_POLL_LINGER             25      /* fast polls after the last activity */
 
 
 typedef enum {
@@ -26,144 +48,389 @@ typedef enum {
 } button_state_t;
 
 typedef struct {
-    const char* name;
-    button_state_t state;
-    unsigned int key;
-    unsigned long gpio;
-    struct timer_list timer;
-} imx_button_t;
+    u64 polls;
+    u64 ns_total;               /* time spent in poll passes */
+    u32 ns_max;
+    u32 interval_ms;            /* current poll interval */
+    u32 keys;                   /* keys in the polled bitmap */
+} button_poll_stats_t;
 
+/*
+ * Per-key state is kept in parallel arrays indexed by scancode so that the
+ * scan timer only walks the keys flagged in the active bitmap. The keymap
+ * array is handed to the input core, which serves EVIOCGKEYCODE and
+ * EVIOCSKEYCODE from it.
+ *
+ * Keys without a usable edge interrupt are flagged in the polled bitmap.
+ * The poll timer samples all of them in one pass and hands a key that went
+ * down to the scan timer, exactly as the interrupt handler does; it ticks
+ * every poll_active_ms while a polled key is busy or was busy recently and
+ * every poll_idle_ms otherwise.
+ */
 typedef struct {
     struct input_dev* input_dev;
+    unsigned int num;
+    unsigned short keymap[IMX_BUTTONS_MAX];
+    int gpio[IMX_BUTTONS_MAX];
+    unsigned char state[IMX_BUTTONS_MAX];
+    DECLARE_BITMAP(active, IMX_BUTTONS_MAX);
+    struct timer_list timer;
+    spinlock_t lock;
+    DECLARE_BITMAP(polled, IMX_BUTTONS_MAX);
+    struct timer_list poll_timer;
+    unsigned int poll_linger;   /* fast polls left */
+    button_poll_stats_t poll;
 } button_dev_t;
 
-imx_button_t imx_buttons[] = {
-    {.name = "button1", .key = KEY_A, .gpio = BUTTON1_PIN, .state = BUTTON_RELEASED},
-    {.name = "button2", .key = KEY_B, .gpio = BUTTON2_PIN, .state = BUTTON_RELEASED},
-    {.name = "button3", .key = KEY_C, .gpio = BUTTON3_PIN, .state = BUTTON_RELEASED},
-    {.name = "button4", .key = KEY_D, .gpio = BUTTON4_PIN, .state = BUTTON_RELEASED},
-    {.name = "button5", .key = KEY_E, .gpio = BUTTON5_PIN, .state = BUTTON_RELEASED},
+static const int imx_default_gpios[] = {
+    BUTTON1_PIN, BUTTON2_PIN, BUTTON3_PIN, BUTTON4_PIN, BUTTON5_PIN,
 };
-#define IMX_BUTTONS_NUM             ARRAY_SIZE(imx_buttons)
+
+static int gpios[IMX_BUTTONS_MAX];
+static int gpios_num = 0;
+module_param_array(gpios, int, &gpios_num, 0444);
+MODULE_PARM_DESC(gpios, "key gpio numbers, one per scancode (default: the five board keys)");
+
+static unsigned int keycodes[IMX_BUTTONS_MAX];
+static int keycodes_num = 0;
+module_param_array(keycodes, uint, &keycodes_num, 0444);
+MODULE_PARM_DESC(keycodes, "initial keycode per scancode (default: KEY_A upwards), remappable with EVIOCSKEYCODE");
+
+static int polled[IMX_BUTTONS_MAX];
+static int polled_num = 0;
+module_param_array(polled, int, &polled_num, 0444);
+MODULE_PARM_DESC(polled, "scancodes to poll instead of interrupting on, keys whose interrupt cannot be set up are polled anyway");
+
+static unsigned int poll_idle_ms = 100;
+module_param(poll_idle_ms, uint, 0644);
+MODULE_PARM_DESC(poll_idle_ms, "poll interval of polled keys while they are idle");
+
+static unsigned int poll_active_ms = 20;
+module_param(poll_active_ms, uint, 0644);
+MODULE_PARM_DESC(poll_active_ms, "poll interval of polled keys while one is pressed and shortly after");
+
+IMX_LOG_DEFINE();
 
 button_dev_t* button_dev = NULL;
 
-static void imx_button_timer(unsigned long arg)
+static void imx_button_set_state(button_dev_t* dev, unsigned int i, button_state_t state)
+{
+    trace_imx_keys_debounce(i, dev->state[i], state);
+    dev->state[i] = state;
+}
+
+static void imx_button_report(button_dev_t* dev, unsigned int i, int value)
 {
-    int i = (int)arg;
-    int level = gpio_get_value(imx_buttons[i].gpio);
-    if (imx_buttons[i].state == BUTTON_PRESSING)
+    trace_imx_keys_report(i, dev->keymap[i], value);
+    input_report_key(dev->input_dev, dev->keymap[i], value);
+}
+
+static void imx_button_scan(button_dev_t* dev, unsigned int i)
+{
+    int level = gpio_get_value(dev->gpio[i]);
+
+    switch (dev->state[i])
     {
+    case BUTTON_PRESSING:
         if (!level)
         {
-            imx_buttons[i].state = BUTTON_PRESSED;
-            input_report_key(button_dev->input_dev, imx_buttons[i].key, 0);
-            input_sync(button_dev->input_dev);
-            printk(">>>%s pressed.\n", imx_buttons[i].name);
+            imx_button_set_state(dev, i, BUTTON_PRESSED);
+            imx_button_report(dev, i, 1);
+            imx_dbg("key %u pressed\n", i);
         }
         else
         {
-            imx_buttons[i].state = BUTTON_RELEASED;
-            return;
+            imx_button_set_state(dev, i, BUTTON_RELEASED);
+            clear_bit(i, dev->active);
         }
-        
-    }
-    else if (imx_buttons[i].state == BUTTON_PRESSED)
-    {
+        break;
+    case BUTTON_PRESSED:
         if (level)
-        {
-            imx_buttons[i].state = BUTTON_RELEASING;
-        }
-        
-    }
-    else if (imx_buttons[i].state == BUTTON_RELEASING)
-    {
+            imx_button_set_state(dev, i, BUTTON_RELEASING);
+        break;
+    case BUTTON_RELEASING:
         if (level)
         {
-            imx_buttons[i].state = BUTTON_RELEASED;
-            input_report_key(button_dev->input_dev, imx_buttons[i].key, 1);
-            input_sync(button_dev->input_dev);
-            printk(">>>>%s released\n", imx_buttons[i].name);
-            return;
+            imx_button_set_state(dev, i, BUTTON_RELEASED);
+            clear_bit(i, dev->active);
+            imx_button_report(dev, i, 0);
+            imx_dbg("key %u released\n", i);
         }
         else
         {
-            imx_buttons[i].state = BUTTON_PRESSED;
+            imx_button_set_state(dev, i, BUTTON_PRESSED);
+        }
+        break;
+    default:
+        clear_bit(i, dev->active);
+        break;
+    }
+}
+
+static void imx_button_timer(struct timer_list* t)
+{
+    button_dev_t* dev = from_timer(dev, t, timer);
+    unsigned long flags;
+    unsigned int i = 0;
+
+    spin_lock_irqsave(&dev->lock, flags);
+    for_each_set_bit(i, dev->active, dev->num)
+    {
+        imx_button_scan(dev, i);
+    }
+    input_sync(dev->input_dev);
+
+    if (!bitmap_empty(dev->active, dev->num))
+        mod_timer(&dev->timer, jiffies + IMX_BUTTONS_SCAN);
+    spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+static void imx_button_poll(struct timer_list* t)
+{
+    button_dev_t* dev = from_timer(dev, t, poll_timer);
+    ktime_t start = ktime_get();
+    unsigned long flags;
+    unsigned int i = 0, sampled = 0, pressed = 0, busy = 0;
+    unsigned int interval = 0;
+    u32 ns = 0;
+
+    spin_lock_irqsave(&dev->lock, flags);
+    for_each_set_bit(i, dev->polled, dev->num)
+    {
+        sampled++;
+        /* keys being debounced belong to the scan timer */
+        if (dev->state[i] != BUTTON_RELEASED)
+        {
+            busy++;
+            continue;
         }
-        
+        if (gpio_get_value(dev->gpio[i]))
+            continue;
+        imx_button_set_state(dev, i, BUTTON_PRESSING);
+        set_bit(i, dev->active);
+        pressed++;
     }
+    if (pressed && !timer_pending(&dev->timer))
+        mod_timer(&dev->timer, jiffies + IMX_BUTTONS_SCAN);
+
+    if (pressed || busy)
+        dev->poll_linger = IMX_POLL_LINGER;
+    else if (dev->poll_linger)
+        dev->poll_linger--;
+    interval = dev->poll_linger ? poll_active_ms : poll_idle_ms;
 
-    imx_buttons[i].timer.expires = jiffies + HZ / 50;
-    add_timer(&imx_buttons[i].timer);
+    ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    dev->poll.polls++;
+    dev->poll.ns_total += ns;
+    dev->poll.ns_max = max(dev->poll.ns_max, ns);
+    dev->poll.interval_ms = interval;
+    spin_unlock_irqrestore(&dev->lock, flags);
+
+    trace_imx_keys_poll(sampled, pressed, ns, interval);
+    mod_timer(&dev->poll_timer, jiffies + max(msecs_to_jiffies(interval), 1UL));
 }
 
+#define IMX_POLL_ATTR(field) \
+static ssize_t field##_show(struct device* d, struct device_attribute* attr, char* buf) \
+{ \
+    unsigned long long value = 0; \
+    unsigned long flags; \
+ \
+    spin_lock_irqsave(&button_dev->lock, flags); \
+    value = button_dev->poll.field; \
+    spin_unlock_irqrestore(&button_dev->lock, flags); \
+    return sprintf(buf, "%llu\n", value); \
+} \
+static DEVICE_ATTR(field, 0444, field##_show, NULL)
+
+IMX_POLL_ATTR(polls);
+IMX_POLL_ATTR(ns_total);
+IMX_POLL_ATTR(ns_max);
+IMX_POLL_ATTR(interval_ms);
+IMX_POLL_ATTR(keys);
+
+static struct attribute* imx_button_poll_attrs[] = {
+    &dev_attr_polls.attr,
+    &dev_attr_ns_total.attr,
+    &dev_attr_ns_max.attr,
+    &dev_attr_interval_ms.attr,
+    &dev_attr_keys.attr,
+    NULL,
+};
+
+/* /sys/class/input/inputN/poll/, present before the device is announced */
+static const struct attribute_group imx_button_poll_group = {
+    .name = "poll",
+    .attrs = imx_button_poll_attrs,
+};
+
+static const struct attribute_group* imx_button_poll_groups[] = {
+    &imx_button_poll_group,
+    NULL,
+};
+
 static irqreturn_t imx_button_irq(int irq, void* dev_id)
 {
-    int gpio_id = (int)dev_id;
-    int level = gpio_get_value(imx_buttons[gpio_id].gpio);
-    if (imx_buttons[gpio_id].state == BUTTON_RELEASED && !level)
+    unsigned int i = (unsigned long)dev_id;
+    int level = gpio_get_value(button_dev->gpio[i]);
+
+    trace_imx_keys_irq(i, level ? 1 : 0);
+    spin_lock(&button_dev->lock);
+    if (button_dev->state[i] == BUTTON_RELEASED && !level)
     {
-        imx_buttons[gpio_id].state = BUTTON_PRESSING;
-        imx_buttons[gpio_id].timer.expires = jiffies + HZ / 50;
-        add_timer(&imx_buttons[gpio_id].timer);
+        imx_button_set_state(button_dev, i, BUTTON_PRESSING);
+        set_bit(i, button_dev->active);
+        if (!timer_pending(&button_dev->timer))
+            mod_timer(&button_dev->timer, jiffies + IMX_BUTTONS_SCAN);
     }
-    printk(">>>>>>>%s, level = %d\n",imx_buttons[gpio_id].name, level ? 1 : 0);
+    spin_unlock(&button_dev->lock);
+    imx_dbg("key %u irq, level = %d\n", i, level ? 1 : 0);
 
     return IRQ_HANDLED;
 }
 
+static int imx_button_request_irq(unsigned int i)
+{
+    int irqno = gpio_to_irq(button_dev->gpio[i]);
+    int ret = 0;
+
+    if (irqno < 0)
+        return irqno;
+    if ((ret = irq_set_irq_type(irqno, IRQ_TYPE_EDGE_FALLING)) != 0)
+        return ret;
+    return request_irq(irqno, imx_button_irq, IRQF_DISABLED, "button", (void*)(unsigned long)i);
+}
+
+static void imx_button_free_irq(unsigned int i)
+{
+    if (!test_bit(i, button_dev->polled))
+        free_irq(gpio_to_irq(button_dev->gpio[i]), (void*)(unsigned long)i);
+}
+
 static int __init button_init(void)
 {
     int i = 0;
     int ret = 0;
-    int irqno = 0;
-    button_dev = kzalloc(sizeof(imx_button_t), GFP_KERNEL);
+    struct input_dev* input_dev = NULL;
 
-    button_dev->input_dev = input_allocate_device();
+    button_dev = kzalloc(sizeof(button_dev_t), GFP_KERNEL);
+    if (!button_dev)
+        return -ENOMEM;
 
-    button_dev->input_dev->name = "imx-keys";
-    set_bit(EV_KEY, button_dev->input_dev->evbit);
-    
-    for (i = 0; i < IMX_BUTTONS_NUM; i++)
+    spin_lock_init(&button_dev->lock);
+    timer_setup(&button_dev->timer, imx_button_timer, 0);
+    timer_setup(&button_dev->poll_timer, imx_button_poll, 0);
+    if (gpios_num)
     {
-        setup_timer(&imx_buttons[i].timer, imx_button_timer, (unsigned long)i);
-        set_bit(imx_buttons[i].key, button_dev->input_dev->keybit);
-        gpio_free(imx_buttons[i].gpio);
-        if ((ret = gpio_request(imx_buttons[i].gpio, "imx-button")) != 0)
+        button_dev->num = gpios_num;
+        memcpy(button_dev->gpio, gpios, gpios_num * sizeof(gpios[0]));
+    }
+    else
+    {
+        button_dev->num = ARRAY_SIZE(imx_default_gpios);
+        memcpy(button_dev->gpio, imx_default_gpios, sizeof(imx_default_gpios));
+    }
+    for (i = 0; i < keycodes_num; i++)
+    {
+        if (keycodes[i] > KEY_MAX)
         {
-            printk(KERN_ERR "gpio: %d request failed,\n", (int)imx_buttons[i].gpio);
-            return ret;
+            imx_err("key %d: invalid keycode %u.\n", i, keycodes[i]);
+            ret = -EINVAL;
+            goto fail0;
         }
-        gpio_direction_input(imx_buttons[i].gpio);
-        irqno = gpio_to_irq(imx_buttons[i].gpio);
-        set_irq_type(irqno, IRQ_TYPE_EDGE_FALLING);
-        if ((ret = request_irq(irqno, imx_button_irq, IRQF_DISABLED, "button", (void*)i)) != 0)
+    }
+    for (i = 0; i < button_dev->num; i++)
+    {
+        button_dev->keymap[i] = i < keycodes_num ? keycodes[i] : KEY_A + i;
+        button_dev->state[i] = BUTTON_RELEASED;
+    }
+    for (i = 0; i < polled_num; i++)
+    {
+        if (polled[i] < 0 || polled[i] >= button_dev->num)
         {
-            printk(KERN_ERR "request irq: %d failed.\n", irqno);
-            return ret;
+            imx_err("polled key %d does not exist.\n", polled[i]);
+            ret = -EINVAL;
+            goto fail0;
         }
+        set_bit(polled[i], button_dev->polled);
+    }
 
-        printk(">>>>%s init pass.\n", imx_buttons[i].name);
+    input_dev = input_allocate_device();
+    if (!input_dev)
+    {
+        ret = -ENOMEM;
+        goto fail0;
     }
-    if ((ret = input_register_device(button_dev->input_dev)) != 0)
+    button_dev->input_dev = input_dev;
+    input_dev->name = "imx-keys";
+    input_dev->keycode = button_dev->keymap;
+    input_dev->keycodesize = sizeof(button_dev->keymap[0]);
+    input_dev->keycodemax = button_dev->num;
+    input_dev->dev.groups = imx_button_poll_groups;
+    set_bit(EV_KEY, input_dev->evbit);
+
+    for (i = 0; i < button_dev->num; i++)
     {
-        printk(KERN_ERR "input register device failed.\n");
-        return ret;
+        if (!gpio_is_valid(button_dev->gpio[i]))
+        {
+            imx_err("key %d: invalid gpio %d.\n", i, button_dev->gpio[i]);
+            ret = -EINVAL;
+            goto fail1;
+        }
+        set_bit(button_dev->keymap[i], input_dev->keybit);
+        gpio_free(button_dev->gpio[i]);
+        if ((ret = gpio_request(button_dev->gpio[i], "imx-button")) != 0)
+        {
+            imx_err("gpio: %d request failed,\n", button_dev->gpio[i]);
+            goto fail1;
+        }
+        gpio_direction_input(button_dev->gpio[i]);
+        if (!test_bit(i, button_dev->polled) && (ret = imx_button_request_irq(i)) != 0)
+        {
+            imx_warn("key %d: no usable interrupt (%d), polling it.\n", i, ret);
+            set_bit(i, button_dev->polled);
+            ret = 0;
+        }
     }
+    button_dev->poll.keys = bitmap_weight(button_dev->polled, button_dev->num);
+    if ((ret = input_register_device(input_dev)) != 0)
+    {
+        imx_err("input register device failed.\n");
+        goto fail1;
+    }
+
+    if (button_dev->poll.keys)
+        mod_timer(&button_dev->poll_timer, jiffies + 1);
 
+    imx_info("%u keys registered, %u polled.\n", button_dev->num, button_dev->poll.keys);
     return 0;
+fail1:
+    while (i--)
+    {
+        imx_button_free_irq(i);
+        gpio_free(button_dev->gpio[i]);
+    }
+    del_timer_sync(&button_dev->timer);
+    input_free_device(input_dev);
+fail0:
+    kfree(button_dev);
+    return ret;
 }
 
 static void __exit button_exit(void)
 {
     int i = 0;
-    int irqno = 0;
 
-    for (i = 0; i < IMX_BUTTONS_NUM; i++)
+    /* the poll timer arms the scan timer, stop it first */
+    del_timer_sync(&button_dev->poll_timer);
+    for (i = 0; i < button_dev->num; i++)
+    {
+        imx_button_free_irq(i);
+    }
+    del_timer_sync(&button_dev->timer);
+    for (i = 0; i < button_dev->num; i++)
     {
-        irqno = gpio_to_irq(imx_buttons[i].gpio);
-        free_irq(irqno, (void*)i);
-        gpio_free(imx_buttons[i].gpio);
+        gpio_free(button_dev->gpio[i]);
     }
 
     input_unregister_device(button_dev->input_dev);
@@ -0,0 +1,82 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM imx_keys
+
+#if !defined(__IMX_KEYS_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __IMX_KEYS_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(imx_keys_irq,
+    TP_PROTO(unsigned int scancode, int level),
+    TP_ARGS(scancode, level),
+    TP_STRUCT__entry(
+        __field(unsigned int, scancode)
+        __field(int, level)
+    ),
+    TP_fast_assign(
+        __entry->scancode = scancode;
+        __entry->level = level;
+    ),
+    TP_printk("scancode=%u level=%d", __entry->scancode, __entry->level)
+);
+
+TRACE_EVENT(imx_keys_debounce,
+    TP_PROTO(unsigned int scancode, int old_state, int new_state),
+    TP_ARGS(scancode, old_state, new_state),
+    TP_STRUCT__entry(
+        __field(unsigned int, scancode)
+        __field(int, old_state)
+        __field(int, new_state)
+    ),
+    TP_fast_assign(
+        __entry->scancode = scancode;
+        __entry->old_state = old_state;
+        __entry->new_state = new_state;
+    ),
+    TP_printk("scancode=%u state=%d->%d", __entry->scancode,
+              __entry->old_state, __entry->new_state)
+);
+
+TRACE_EVENT(imx_keys_report,
+    TP_PROTO(unsigned int scancode, unsigned int keycode, int value),
+    TP_ARGS(scancode, keycode, value),
+    TP_STRUCT__entry(
+        __field(unsigned int, scancode)
+        __field(unsigned int, keycode)
+        __field(int, value)
+    ),
+    TP_fast_assign(
+        __entry->scancode = scancode;
+        __entry->keycode = keycode;
+        __entry->value = value;
+    ),
+    TP_printk("scancode=%u keycode=%u value=%d", __entry->scancode,
+              __entry->keycode, __entry->value)
+);
+
+TRACE_EVENT(imx_keys_poll,
+    TP_PROTO(unsigned int sampled, unsigned int pressed, u32 ns, unsigned int interval_ms),
+    TP_ARGS(sampled, pressed, ns, interval_ms),
+    TP_STRUCT__entry(
+        __field(unsigned int, sampled)
+        __field(unsigned int, pressed)
+        __field(u32, ns)
+        __field(unsigned int, interval_ms)
+    ),
+    TP_fast_assign(
+        __entry->sampled = sampled;
+        __entry->pressed = pressed;
+        __entry->ns = ns;
+        __entry->interval_ms = interval_ms;
+    ),
+    TP_printk("sampled=%u pressed=%u ns=%u next=%ums", __entry->sampled,
+              __entry->pressed, __entry->ns, __entry->interval_ms)
+);
+
+#endif /* __IMX_KEYS_TRACE_H__ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE imx_keys_trace
+#include <trace/define_trace.h>
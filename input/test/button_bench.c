@@ -0,0 +1,381 @@
+/*
+ * Injection-to-userspace latency benchmark for the imx-keys input driver.
+ *
+ * The driver is loaded on a host kernel with its keys bound to gpio-mockup
+ * lines, e.g.
+ *
+ *   modprobe gpio-mockup gpio_mockup_ranges=-1,8
+ *   insmod button.ko gpios=<base>,<base+1>,<base+2>,<base+3>,<base+4>
+ *   ./button_bench -d /sys/kernel/debug/gpio-mockup/gpiochip1 -l 0,1,2,3,4
+ *
+ * Edges are injected by writing the mockup line pull through debugfs and the
+ * resulting key events are consumed with epoll. Keys are active low, so a
+ * press drives the line to 0 and a release back to 1.
+ */
+#include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#include "../../bench/bench_common.h"
+
+
+#ifndef input_event_sec
+#define input_event_sec         time.tv_sec
+#define input_event_usec        time.tv_usec
+#endif
+
+#define BENCH_DEV_NAME          "imx-keys"
+#define BENCH_DEBOUNCE_MS       20      /* IMX_BUTTONS_SCAN of the driver */
+
+typedef struct {
+    int fd;
+    unsigned int code;
+    pending_t press;
+    pending_t release;
+} bench_key_t;
+
+static bench_key_t keys[BENCH_MAX_KEYS];
+static int keys_num = 0;
+
+static samples_t read_lat, kernel_lat;
+static unsigned long expected = 0, received = 0, unexpected = 0, syn_dropped = 0;
+
+static int set_line(int key, int level)
+{
+    return set_mockup_line(keys[key].fd, level);
+}
+
+static int find_evdev(void)
+{
+    char path[64];
+    char name[256];
+    int i = 0;
+    int fd = 0;
+
+    for (i = 0; i < 64; i++)
+    {
+        snprintf(path, sizeof(path), "/dev/input/event%d", i);
+        fd = open(path, O_RDONLY | O_NONBLOCK);
+        if (fd < 0)
+            continue;
+        memset(name, 0, sizeof(name));
+        if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) >= 0 &&
+            strcmp(name, BENCH_DEV_NAME) == 0)
+            return fd;
+        close(fd);
+    }
+    return -1;
+}
+
+static int key_by_code(unsigned int code)
+{
+    int i = 0;
+    for (i = 0; i < keys_num; i++)
+    {
+        if (keys[i].code == code)
+            return i;
+    }
+    return -1;
+}
+
+static void drain_events(int evfd)
+{
+    struct input_event ev[64];
+    long long now = now_ns();
+    long long t = 0;
+    ssize_t ret = 0;
+    int i = 0, n = 0, k = 0;
+
+    while ((ret = read(evfd, ev, sizeof(ev))) > 0)
+    {
+        n = ret / sizeof(ev[0]);
+        for (i = 0; i < n; i++)
+        {
+            if (ev[i].type == EV_SYN && ev[i].code == SYN_DROPPED)
+            {
+                syn_dropped++;
+                continue;
+            }
+            if (ev[i].type != EV_KEY || ev[i].value == 2)
+                continue;
+            k = key_by_code(ev[i].code);
+            if (k < 0 || pending_pop(ev[i].value ? &keys[k].press : &keys[k].release, &t) < 0)
+            {
+                unexpected++;
+                continue;
+            }
+            received++;
+            sample_add(&read_lat, now - t);
+            sample_add(&kernel_lat,
+                       (long long)ev[i].input_event_sec * 1000000000LL +
+                       ev[i].input_event_usec * 1000LL - t);
+        }
+    }
+}
+
+/* Run the queued actions on schedule, consuming events in between. */
+static int run_actions(const char* pattern, int epfd, int evfd, long long settle_ns)
+{
+    struct epoll_event event;
+    long long start = 0, end = 0, now = 0, wait = 0;
+    size_t next = 0;
+    int i = 0;
+
+    expected = received = unexpected = syn_dropped = 0;
+    read_lat.n = kernel_lat.n = 0;
+    for (i = 0; i < keys_num; i++)
+    {
+        pending_reset(&keys[i].press);
+        pending_reset(&keys[i].release);
+    }
+
+    start = now_ns();
+    end = start + (actions_num ? actions[actions_num - 1].at : 0) + settle_ns;
+    while (1)
+    {
+        now = now_ns();
+        while (next < actions_num && start + actions[next].at <= now)
+        {
+            action_t* a = actions + next++;
+            long long t = now_ns();
+            if (set_line(a->key, a->level) < 0)
+                return -1;
+            if (a->expect == EXPECT_PRESS)
+                pending_push(&keys[a->key].press, t);
+            else if (a->expect == EXPECT_RELEASE)
+                pending_push(&keys[a->key].release, t);
+            if (a->expect != EXPECT_NONE)
+                expected++;
+        }
+        now = now_ns();
+        if (next == actions_num && (now >= end || received == expected))
+            break;
+        wait = (next < actions_num ? start + actions[next].at : end) - now;
+        if (wait < 0)
+            wait = 0;
+        /* sleep in epoll for whole milliseconds, spin on the remainder */
+        if (epoll_wait(epfd, &event, 1, (int)(wait / 1000000)) > 0)
+            drain_events(evfd);
+    }
+    drain_events(evfd);
+    end = now_ns();
+
+    printf("%s.injected %lu\n", pattern, expected);
+    printf("%s.received %lu\n", pattern, received);
+    printf("%s.dropped %lu\n", pattern, expected > received ? expected - received : 0);
+    printf("%s.unexpected %lu\n", pattern, unexpected);
+    printf("%s.syn_dropped %lu\n", pattern, syn_dropped);
+    printf("%s.events_per_sec %.1f\n", pattern, received * 1e9 / (double)(end - start));
+    report_samples("", pattern, "read_latency", &read_lat);
+    report_samples("", pattern, "kernel_latency", &kernel_lat);
+    return 0;
+}
+
+static void pattern_clean(int iterations, long long hold)
+{
+    long long t = 0;
+    int i = 0;
+    for (i = 0; i < iterations; i++)
+    {
+        add_action(t, i % keys_num, 0, EXPECT_PRESS);
+        add_action(t + hold, i % keys_num, 1, EXPECT_RELEASE);
+        t += 2 * hold;
+    }
+}
+
+static void pattern_bouncy(int iterations, long long hold, long long bounce)
+{
+    long long t = 0;
+    int i = 0, j = 0, k = 0;
+    for (i = 0; i < iterations; i++)
+    {
+        k = i % keys_num;
+        add_action(t, k, 0, EXPECT_PRESS);
+        for (j = 1; j <= 4; j++)
+            add_action(t + j * bounce, k, j & 1, EXPECT_NONE);
+        add_action(t + hold, k, 1, EXPECT_RELEASE);
+        for (j = 1; j <= 4; j++)
+            add_action(t + hold + j * bounce, k, !(j & 1), EXPECT_NONE);
+        add_action(t + hold + 5 * bounce, k, 1, EXPECT_NONE);
+        t += 2 * hold;
+    }
+}
+
+static void pattern_chord(int iterations, long long hold)
+{
+    long long t = 0;
+    int i = 0, k = 0;
+    for (i = 0; i < iterations; i++)
+    {
+        for (k = 0; k < keys_num; k++)
+            add_action(t, k, 0, EXPECT_PRESS);
+        for (k = 0; k < keys_num; k++)
+            add_action(t + hold, k, 1, EXPECT_RELEASE);
+        t += 2 * hold;
+    }
+}
+
+/*
+ * Presses as fast as the debouncer can confirm them. Each press is held for
+ * two scan intervals so the driver reports it, and a key is only pressed
+ * again five intervals later, once its release has been confirmed with a
+ * tick to spare. Keys are used round robin, so the rate grows with the
+ * number of keys; period (-r) can only lower it.
+ */
+static void pattern_burst(int iterations, long long period, long long debounce)
+{
+    long long hold = 2 * debounce;
+    long long min_period = (5 * debounce + keys_num - 1) / keys_num;
+    long long t = 0;
+    int i = 0;
+
+    if (period < min_period)
+        period = min_period;
+    for (i = 0; i < iterations; i++)
+    {
+        add_action(t, i % keys_num, 0, EXPECT_PRESS);
+        add_action(t + hold, i % keys_num, 1, EXPECT_RELEASE);
+        t += period;
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s -d <gpio-mockup debugfs dir> -l <line,...> [options]\n"
+            "  -e <evdev>     event device (default: find \"" BENCH_DEV_NAME "\")\n"
+            "  -p <pattern>   clean|bouncy|chord|burst|all (default all)\n"
+            "  -n <count>     iterations per pattern (default 100)\n"
+            "  -h <ms>        hold time of a press (default 60)\n"
+            "  -b <us>        bounce interval (default 500)\n"
+            "  -r <hz>        burst press rate cap (default: what the debounce allows)\n"
+            "  -s <ms>        driver debounce interval (default 20)\n",
+            prog);
+}
+
+int main(int argc, char* const argv[])
+{
+    const char* debugfs = NULL;
+    const char* lines = NULL;
+    const char* evdev = NULL;
+    const char* pattern = "all";
+    int iterations = 100;
+    long long hold = 60000000LL;
+    long long bounce = 500000LL;
+    long long period = 0;
+    long long debounce = BENCH_DEBOUNCE_MS * 1000000LL;
+    struct epoll_event event;
+    char path[256];
+    char* tok = NULL;
+    char* list = NULL;
+    int epfd = 0, evfd = 0;
+    int clk = CLOCK_MONOTONIC;
+    int opt = 0, i = 0, ret = 0;
+    static const char* const patterns[] = {"clean", "bouncy", "chord", "burst"};
+
+    while ((opt = getopt(argc, argv, "d:l:e:p:n:h:b:r:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd': debugfs = optarg; break;
+        case 'l': lines = optarg; break;
+        case 'e': evdev = optarg; break;
+        case 'p': pattern = optarg; break;
+        case 'n': iterations = atoi(optarg); break;
+        case 'h': hold = atoll(optarg) * 1000000LL; break;
+        case 'b': bounce = atoll(optarg) * 1000LL; break;
+        case 'r': period = atoll(optarg) > 0 ? 1000000000LL / atoll(optarg) : -1; break;
+        case 's': debounce = atoll(optarg) * 1000000LL; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!debugfs || !lines || iterations <= 0 || period < 0 || debounce <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    evfd = evdev ? open(evdev, O_RDONLY | O_NONBLOCK) : find_evdev();
+    if (evfd < 0)
+    {
+        fprintf(stderr, "no " BENCH_DEV_NAME " event device found\n");
+        return 1;
+    }
+#ifdef EVIOCSCLOCKID
+    ioctl(evfd, EVIOCSCLOCKID, &clk);
+#endif
+
+    list = strdup(lines);
+    for (tok = strtok(list, ","); tok && keys_num < BENCH_MAX_KEYS; tok = strtok(NULL, ","))
+    {
+        unsigned int scan[2] = {keys_num, 0};
+        snprintf(path, sizeof(path), "%s/%s", debugfs, tok);
+        keys[keys_num].fd = open(path, O_WRONLY);
+        if (keys[keys_num].fd < 0)
+        {
+            perror(path);
+            return 1;
+        }
+        /* key index i is scancode i of the driver keymap */
+        if (ioctl(evfd, EVIOCGKEYCODE, scan) < 0)
+            scan[1] = KEY_A + keys_num;
+        keys[keys_num].code = scan[1];
+        set_line(keys_num, 1);
+        keys_num++;
+    }
+    free(list);
+
+    read_lat.v = malloc(BENCH_MAX_SAMPLES * sizeof(long long));
+    kernel_lat.v = malloc(BENCH_MAX_SAMPLES * sizeof(long long));
+    epfd = epoll_create1(0);
+    event.events = EPOLLIN;
+    event.data.fd = evfd;
+    if (!read_lat.v || !kernel_lat.v || epfd < 0 ||
+        epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &event) < 0)
+    {
+        perror("setup");
+        return 1;
+    }
+
+    usleep(100000);
+    drain_events(evfd);
+
+    for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++)
+    {
+        if (strcmp(pattern, "all") && strcmp(pattern, patterns[i]))
+            continue;
+        actions_num = 0;
+        switch (i)
+        {
+        case 0: pattern_clean(iterations, hold); break;
+        case 1: pattern_bouncy(iterations, hold, bounce); break;
+        case 2: pattern_chord(iterations, hold); break;
+        case 3: pattern_burst(iterations, period, debounce); break;
+        }
+        if ((ret = run_actions(patterns[i], epfd, evfd, 2 * hold)) < 0)
+            break;
+        usleep(2 * hold / 1000);
+        drain_events(evfd);
+    }
+
+    for (i = 0; i < keys_num; i++)
+        close(keys[i].fd);
+    close(epfd);
+    close(evfd);
+    free(actions);
+    free(read_lat.v);
+    free(kernel_lat.v);
+    return ret ? 1 : 0;
+}
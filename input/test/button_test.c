@@ -22,7 +22,7 @@ int main(int argc, char* const argv[])
         printf(">>> read event\n");
         ret = read(fd, &event, sizeof(event));
         printf(">>>type=%d, code=%d, value=%d\n", event.type, event.code, event.value);
-        sleep(0.1);
+        usleep(100000);
     }
 
     return 0;
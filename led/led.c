@@ -1,100 +1,693 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/cdev.h>
 #include <linux/fs.h>
 #include <asm/uaccess.h>
 #include <linux/slab.h>
+#include <linux/gpio.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/bitops.h>
+#include <linux/leds.h>
+#include "imx28_compat.h"
+#include "imx28_log.h"
+#define CREATE_TRACE_POINTS
+#include "led_trace.h"
+#include "led_ioctl.h"
+#include "led_route.h"
+
+#ifdef CONFIG_ARCH_MX28
 #include "../arch/arm/mach-mx28/mx28_pins.h"
 
+#define LED_PIN             MXS_PIN_TO_GPIO(PINID_LCD_D23)
+#else
+/* no default pin off the board, it must be given with gpios= */
+#define LED_PIN             -1
+#endif
+
 
 #define LED_DEV_MINORS      1
 #define LED_DEV_MAJOR       0
 #define LED_DEV_NAME        "led"
-#define LED_PIN             MXS_PIN_TO_GPIO(PINID_LCD_D23)
+#define LED_PWM_FREQ_MAX    10000
 
 unsigned long led_dev_major = LED_DEV_MAJOR;
 
+IMX_LOG_DEFINE();
+
+static unsigned int pwm_freq = 200;
+module_param(pwm_freq, uint, 0444);
+MODULE_PARM_DESC(pwm_freq, "initial software PWM frequency in Hz");
+
+static int gpios[LED_MAX] = {LED_PIN};
+static int gpios_num = 1;
+module_param_array(gpios, int, &gpios_num, 0444);
+MODULE_PARM_DESC(gpios, "LED gpio numbers, LED n is bit n of the frame mask");
+
+static char* triggers[LED_MAX];
+static int triggers_num = 0;
+module_param_array(triggers, charp, &triggers_num, 0444);
+MODULE_PARM_DESC(triggers, "default LED class trigger per LED, e.g. heartbeat,timer");
+
+#if defined(CONFIG_LEDS_CLASS) || defined(CONFIG_LEDS_CLASS_MODULE)
+#define LED_HAVE_CLASS
+#endif
+
+/*
+ * Software PWM: the hrtimer only fires on the two edges of each period and
+ * is not running at all for brightness 0 and LED_BRIGHTNESS_MAX, where the
+ * pin is simply driven low or high.
+ *
+ * All LED state is under the per-LED spinlock and every setter is safe in
+ * atomic context, since the LED class and its triggers call in from timers.
+ * Setters never wait for the PWM or pattern callbacks; a callback that lost
+ * the race sees the new state under the lock and stops itself.
+ *
+ * Plain on/off changes of LEDs that are neither dimmed nor running a pattern
+ * bypass all of that: they only touch the atomic state word and the pins.
+ */
 typedef struct {
+    int gpio;
+    unsigned int index;
+    spinlock_t lock;
+    struct hrtimer pwm_timer;
+    unsigned int brightness;
+    int pwm_running;
+    int pwm_level;
+    ktime_t pwm_on;
+    ktime_t pwm_off;
+    u64 pwm_callbacks;
+    struct timer_list pattern_timer;
+    int pattern_active;
+    led_pattern_t pattern;
+    unsigned int pattern_step;
+    unsigned int pattern_runs;
+    struct led_dev* dev;
+#ifdef LED_HAVE_CLASS
+    struct led_classdev classdev;
+    char name[16];
+#endif
+} led_t;
+
+typedef struct led_dev {
     struct cdev cdev;
+    struct mutex ctl_lock;
+    unsigned int num;
+    unsigned int pwm_freq;
+    unsigned long state;        /* cached on/off bit per LED */
+    unsigned long pwm_active;
+    unsigned long slow;         /* LEDs owned by the PWM or pattern timers */
+    u64 stats_callbacks;
+    ktime_t stats_stamp;
+    led_t leds[LED_MAX];
 } led_dev_t;
 
-static int led_open(struct inode* inode, struct file* file)
+/* Must be called with led->lock held. */
+static void led_update_slow(led_t* led)
 {
-    int ret = gpio_request(LED_PIN, "LED");
-    if (ret < 0)
+    if (led->pwm_running || led->pattern_active)
+        set_bit(led->index, &led->dev->slow);
+    else
+        clear_bit(led->index, &led->dev->slow);
+}
+
+static enum hrtimer_restart led_pwm_timer(struct hrtimer* timer)
+{
+    led_t* led = container_of(timer, led_t, pwm_timer);
+    enum hrtimer_restart ret = HRTIMER_NORESTART;
+    unsigned long flags;
+
+    spin_lock_irqsave(&led->lock, flags);
+    led->pwm_callbacks++;
+    /* stopped, or already restarted by a setter while we waited */
+    if (led->pwm_running && !hrtimer_is_queued(timer))
+    {
+        led->pwm_level = !led->pwm_level;
+        gpio_set_value(led->gpio, led->pwm_level);
+        trace_led_pwm_edge(led->index, led->pwm_level);
+        hrtimer_forward_now(timer, led->pwm_level ? led->pwm_on : led->pwm_off);
+        ret = HRTIMER_RESTART;
+    }
+    spin_unlock_irqrestore(&led->lock, flags);
+
+    return ret;
+}
+
+/*
+ * Record the brightness an LED was last set to, for the PWM frequency
+ * updates and for the LED class core, which reports classdev.brightness in
+ * sysfs. Written without the lock by the on/off fast path.
+ */
+static void led_store_brightness(led_t* led, unsigned int brightness)
+{
+    WRITE_ONCE(led->brightness, brightness);
+#ifdef LED_HAVE_CLASS
+    WRITE_ONCE(led->classdev.brightness, brightness);
+#endif
+}
+
+/* Must be called with led->lock held. */
+static void __led_set_brightness(led_t* led, unsigned int brightness)
+{
+    u64 period = 0;
+    u64 on = 0;
+
+    if (brightness > LED_BRIGHTNESS_MAX)
+        brightness = LED_BRIGHTNESS_MAX;
+
+    trace_led_brightness(led->index, brightness);
+    led_store_brightness(led, brightness);
+    if (brightness == 0 || brightness == LED_BRIGHTNESS_MAX)
+    {
+        led->pwm_running = 0;
+        hrtimer_try_to_cancel(&led->pwm_timer);
+        clear_bit(led->index, &led->dev->pwm_active);
+        led->pwm_level = brightness ? 1 : 0;
+        gpio_set_value(led->gpio, led->pwm_level);
+    }
+    else
+    {
+        period = div_u64(NSEC_PER_SEC, led->dev->pwm_freq);
+        on = div_u64(period * brightness, LED_BRIGHTNESS_MAX);
+        led->pwm_on = ns_to_ktime(on);
+        led->pwm_off = ns_to_ktime(period - on);
+        /* a running PWM picks the new duty cycle up at its next edge */
+        if (!led->pwm_running)
+        {
+            set_bit(led->index, &led->dev->pwm_active);
+            led->pwm_running = 1;
+            led->pwm_level = 1;
+            gpio_set_value(led->gpio, 1);
+            hrtimer_start(&led->pwm_timer, led->pwm_on, HRTIMER_MODE_REL);
+        }
+    }
+    if (brightness)
+        set_bit(led->index, &led->dev->state);
+    else
+        clear_bit(led->index, &led->dev->state);
+    led_update_slow(led);
+}
+
+static void led_set_brightness(led_t* led, unsigned int brightness)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&led->lock, flags);
+    __led_set_brightness(led, brightness);
+    spin_unlock_irqrestore(&led->lock, flags);
+}
+
+/* Must be called with ctl_lock held. */
+static int led_set_pwm_freq(led_dev_t* dev, unsigned int freq)
+{
+    unsigned int i = 0;
+
+    if (freq == 0 || freq > LED_PWM_FREQ_MAX)
+        return -EINVAL;
+
+    dev->pwm_freq = freq;
+    for_each_set_bit(i, &dev->pwm_active, dev->num)
+    {
+        led_set_brightness(dev->leds + i, dev->leds[i].brightness);
+    }
+    return 0;
+}
+
+/* Must be called with ctl_lock held. */
+static void led_get_pwm_stats(led_dev_t* dev, led_pwm_stats_t* stats)
+{
+    unsigned long flags;
+    ktime_t now = ktime_get();
+    u64 callbacks = 0;
+    u64 elapsed = 0;
+    unsigned int i = 0;
+
+    for (i = 0; i < dev->num; i++)
+    {
+        spin_lock_irqsave(&dev->leds[i].lock, flags);
+        callbacks += dev->leds[i].pwm_callbacks;
+        spin_unlock_irqrestore(&dev->leds[i].lock, flags);
+    }
+
+    stats->freq = dev->pwm_freq;
+    stats->pwm_active = dev->pwm_active;
+    stats->callbacks = callbacks;
+    elapsed = ktime_to_ns(ktime_sub(now, dev->stats_stamp));
+    stats->callbacks_per_sec = elapsed ?
+        div64_u64((callbacks - dev->stats_callbacks) * NSEC_PER_SEC, elapsed) : 0;
+    stats->reserved = 0;
+    dev->stats_callbacks = callbacks;
+    dev->stats_stamp = now;
+}
+
+static void led_pattern_timer(struct timer_list* t)
+{
+    led_t* led = from_timer(led, t, pattern_timer);
+    led_pattern_step_t* step = NULL;
+    unsigned long flags;
+
+    spin_lock_irqsave(&led->lock, flags);
+    /* stopped, or already restarted by a setter while we waited */
+    if (!led->pattern_active || timer_pending(&led->pattern_timer))
+        goto out;
+
+    if (++led->pattern_step == led->pattern.steps_num)
+    {
+        led->pattern_step = 0;
+        if (led->pattern.repeat && ++led->pattern_runs == led->pattern.repeat)
+        {
+            led->pattern_active = 0;
+            led_update_slow(led);
+            goto out;
+        }
+    }
+
+    step = led->pattern.steps + led->pattern_step;
+    __led_set_brightness(led, step->brightness);
+    mod_timer(&led->pattern_timer, led->pattern_timer.expires + msecs_to_jiffies(step->duration_ms));
+out:
+    spin_unlock_irqrestore(&led->lock, flags);
+}
+
+static void led_stop_pattern(led_t* led)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&led->lock, flags);
+    led->pattern_active = 0;
+    del_timer(&led->pattern_timer);
+    led_update_slow(led);
+    spin_unlock_irqrestore(&led->lock, flags);
+}
+
+static int led_check_pattern(const led_pattern_t* pattern)
+{
+    unsigned int i = 0;
+
+    if (pattern->steps_num == 0 || pattern->steps_num > LED_PATTERN_STEPS_MAX)
+        return -EINVAL;
+    for (i = 0; i < pattern->steps_num; i++)
+    {
+        if (pattern->steps[i].duration_ms == 0)
+            return -EINVAL;
+    }
+    return 0;
+}
+
+static int led_start_pattern(led_t* led, const led_pattern_t* pattern)
+{
+    unsigned long flags;
+    int ret = 0;
+
+    if ((ret = led_check_pattern(pattern)) < 0)
+        return ret;
+
+    spin_lock_irqsave(&led->lock, flags);
+    led->pattern = *pattern;
+    led->pattern_step = 0;
+    led->pattern_runs = 0;
+    led->pattern_active = 1;
+    __led_set_brightness(led, pattern->steps[0].brightness);
+    mod_timer(&led->pattern_timer, jiffies + msecs_to_jiffies(pattern->steps[0].duration_ms));
+    spin_unlock_irqrestore(&led->lock, flags);
+    return 0;
+}
+
+/*
+ * Bring the pins and brightness of the LEDs in mask in line with the state
+ * word. A pin is rewritten until the state bit read after the write
+ * matches, so whichever of two racing writers changes the state last also
+ * leaves its level on the pin and its brightness recorded.
+ */
+static void led_sync_pins(led_dev_t* dev, unsigned long mask)
+{
+    unsigned int i = 0;
+    int on = 0;
+
+    for_each_set_bit(i, &mask, dev->num)
+    {
+        do
+        {
+            on = test_bit(i, &dev->state);
+            gpio_set_value(dev->leds[i].gpio, on);
+            led_store_brightness(dev->leds + i, on ? LED_BRIGHTNESS_MAX : 0);
+        } while (test_bit(i, &dev->state) != on);
+    }
+}
+
+/*
+ * Set (or toggle) the on/off state of the LEDs in mask. LEDs without a
+ * timer attached take the lock-free path: one cmpxchg on the state word,
+ * then only the pins that changed are written.
+ */
+static void led_update_state(led_dev_t* dev, unsigned long mask, unsigned long value, int toggle)
+{
+    unsigned long slow = mask & dev->slow;
+    unsigned long fast = mask & ~slow;
+    unsigned long old = 0, new = 0;
+    unsigned int i = 0;
+    int on = 0;
+
+    for_each_set_bit(i, &slow, dev->num)
     {
-        printk("gpio request failed.\n");
-        //return -1;
+        on = toggle ? !test_bit(i, &dev->state) : (value >> i) & 1;
+        led_stop_pattern(dev->leds + i);
+        led_set_brightness(dev->leds + i, on ? LED_BRIGHTNESS_MAX : 0);
+    }
+
+    if (!fast)
+        return;
+    do
+    {
+        old = dev->state;
+        new = toggle ? old ^ fast : (old & ~fast) | (value & fast);
+    } while (cmpxchg(&dev->state, old, new) != old);
+    trace_led_state(old, new);
+    led_sync_pins(dev, old ^ new);
+}
+
+static int led_check_mask(led_dev_t* dev, u32 mask)
+{
+    return (mask & ~(u32)((1ULL << dev->num) - 1)) ? -EINVAL : 0;
+}
+
+led_dev_t* led_dev = NULL;
+
+int led_route_check(u32 mask, unsigned int action, const led_pattern_t* pattern)
+{
+    int ret = 0;
+
+    if (!led_dev)
+        return -ENODEV;
+    if ((ret = led_check_mask(led_dev, mask)) < 0)
+        return ret;
+    switch (action)
+    {
+    case LED_ACTION_NONE:
+    case LED_ACTION_OFF:
+    case LED_ACTION_ON:
+    case LED_ACTION_TOGGLE:
+        return 0;
+    case LED_ACTION_PATTERN:
+        return led_check_pattern(pattern);
+    default:
+        return -EINVAL;
+    }
+}
+EXPORT_SYMBOL_GPL(led_route_check);
+
+int led_route(u32 mask, unsigned int action, const led_pattern_t* pattern)
+{
+    unsigned long leds = mask;
+    unsigned int i = 0;
+    int ret = 0;
+
+    if ((ret = led_route_check(mask, action, pattern)) < 0)
+        return ret;
+    switch (action)
+    {
+    case LED_ACTION_OFF:
+    case LED_ACTION_ON:
+        led_update_state(led_dev, mask, action == LED_ACTION_ON ? mask : 0, 0);
+        break;
+    case LED_ACTION_TOGGLE:
+        led_update_state(led_dev, mask, 0, 1);
+        break;
+    case LED_ACTION_PATTERN:
+        for_each_set_bit(i, &leds, led_dev->num)
+        {
+            led_start_pattern(led_dev->leds + i, pattern);
+        }
+        break;
     }
-        
     return 0;
 }
+EXPORT_SYMBOL_GPL(led_route);
+
+#ifdef LED_HAVE_CLASS
+static void led_classdev_brightness_set(struct led_classdev* classdev, enum led_brightness value)
+{
+    led_t* led = container_of(classdev, led_t, classdev);
+
+    led_stop_pattern(led);
+    led_set_brightness(led, value);
+}
+
+/* Blinking is offloaded to the pattern timer instead of the core's software blink. */
+static int led_classdev_blink_set(struct led_classdev* classdev,
+                                  unsigned long* delay_on, unsigned long* delay_off)
+{
+    led_t* led = container_of(classdev, led_t, classdev);
+    led_pattern_t pattern;
+
+    if (*delay_on == 0 && *delay_off == 0)
+        *delay_on = *delay_off = 500;
+    if (*delay_on == 0 || *delay_off == 0)
+        return -EINVAL;
+
+    pattern.index = led->index;
+    pattern.steps_num = 2;
+    pattern.repeat = 0;
+    pattern.steps[0].brightness = LED_BRIGHTNESS_MAX;
+    pattern.steps[0].duration_ms = *delay_on;
+    pattern.steps[1].brightness = 0;
+    pattern.steps[1].duration_ms = *delay_off;
+    return led_start_pattern(led, &pattern);
+}
+
+static int led_classdev_init(led_t* led)
+{
+    snprintf(led->name, sizeof(led->name), "imx28:led%u", led->index);
+    led->classdev.name = led->name;
+    led->classdev.max_brightness = LED_BRIGHTNESS_MAX;
+    led->classdev.brightness_set = led_classdev_brightness_set;
+    led->classdev.blink_set = led_classdev_blink_set;
+    if (led->index < triggers_num)
+        led->classdev.default_trigger = triggers[led->index];
+    return led_classdev_register(NULL, &led->classdev);
+}
 
-static int led_release(struct inode* inode, struct file* file)
+static void led_classdev_deinit(led_t* led)
+{
+    led_classdev_unregister(&led->classdev);
+}
+#else
+static int led_classdev_init(led_t* led)
 {
-    gpio_free(LED_PIN);
     return 0;
 }
 
-static int led_read(struct file* file, char __user* rd_data, size_t rd_len, loff_t* offset)
+static void led_classdev_deinit(led_t* led)
+{
+}
+#endif
+
+static int led_open(struct inode* inode, struct file* file)
 {
-    int level = gpio_direction_input(LED_PIN);
-    put_user(level, rd_data);
+    led_dev_t* dev = container_of(inode->i_cdev, led_dev_t, cdev);
+
+    file->private_data = dev;
     return 0;
 }
 
-static int led_write(struct file* file, char __user* wr_data, size_t wr_len, loff_t* offset)
+static ssize_t led_read(struct file* file, char __user* rd_data, size_t rd_len, loff_t* offset)
 {
+    led_dev_t* dev = file->private_data;
+    u32 state = dev->state;
+
+    if (rd_len > sizeof(state))
+        rd_len = sizeof(state);
+    if (copy_to_user(rd_data, &state, rd_len))
+        return -EFAULT;
+    return rd_len;
+}
+
+static ssize_t led_write(struct file* file, const char __user* wr_data, size_t wr_len, loff_t* offset)
+{
+    led_dev_t* dev = file->private_data;
+    led_frame_t frame;
     int level = 0;
+    int ret = 0;
+
+    if (wr_len == sizeof(frame))
+    {
+        if (copy_from_user(&frame, wr_data, sizeof(frame)))
+            return -EFAULT;
+        if ((ret = led_check_mask(dev, frame.mask)) < 0)
+            return ret;
+        led_update_state(dev, frame.mask, frame.value, 0);
+        return wr_len;
+    }
+
     get_user(level, wr_data);
-    printk("led write level = %d\n", level);
-    gpio_direction_output(LED_PIN, level);
+    led_update_state(dev, 1, level ? 1 : 0, 0);
     return 0;
 }
 
-static int led_unlocked_ioctl(struct file* file, unsigned int cmd, unsigned long arg)
+static long led_unlocked_ioctl(struct file* file, unsigned int cmd, unsigned long arg)
 {
-    printk("ioctl cmd=%d\n", cmd);
+    led_dev_t* dev = file->private_data;
+    led_pwm_stats_t stats;
+    led_pattern_t pattern;
+    led_brightness_t brightness;
+    led_frame_t frame;
+    unsigned int val = 0;
+    int ret = 0;
+
     switch (cmd)
     {
     case 0:
-        gpio_direction_output(LED_PIN, 0);
-        break;
     case 1:
-        gpio_direction_output(LED_PIN, 1);
+        led_update_state(dev, 1, cmd, 0);
+        break;
+    case LED_IOC_SET_BRIGHTNESS:
+        if (copy_from_user(&brightness, (void __user*)arg, sizeof(brightness)))
+            return -EFAULT;
+        if (brightness.index >= dev->num)
+            return -EINVAL;
+        led_stop_pattern(dev->leds + brightness.index);
+        led_set_brightness(dev->leds + brightness.index, brightness.brightness);
+        break;
+    case LED_IOC_SET_PWM_FREQ:
+        if (get_user(val, (__u32 __user*)arg))
+            return -EFAULT;
+        mutex_lock(&dev->ctl_lock);
+        ret = led_set_pwm_freq(dev, val);
+        mutex_unlock(&dev->ctl_lock);
         break;
+    case LED_IOC_GET_PWM_STATS:
+        mutex_lock(&dev->ctl_lock);
+        led_get_pwm_stats(dev, &stats);
+        mutex_unlock(&dev->ctl_lock);
+        if (copy_to_user((void __user*)arg, &stats, sizeof(stats)))
+            return -EFAULT;
+        break;
+    case LED_IOC_SET_PATTERN:
+        if (copy_from_user(&pattern, (void __user*)arg, sizeof(pattern)))
+            return -EFAULT;
+        if (pattern.index >= dev->num)
+            return -EINVAL;
+        ret = led_start_pattern(dev->leds + pattern.index, &pattern);
+        break;
+    case LED_IOC_STOP_PATTERN:
+        if (get_user(val, (__u32 __user*)arg))
+            return -EFAULT;
+        if (val >= dev->num)
+            return -EINVAL;
+        led_stop_pattern(dev->leds + val);
+        break;
+    case LED_IOC_SET_FRAME:
+        if (copy_from_user(&frame, (void __user*)arg, sizeof(frame)))
+            return -EFAULT;
+        if ((ret = led_check_mask(dev, frame.mask)) < 0)
+            return ret;
+        led_update_state(dev, frame.mask, frame.value, 0);
+        break;
+    case LED_IOC_TOGGLE:
+        if (get_user(val, (__u32 __user*)arg))
+            return -EFAULT;
+        if ((ret = led_check_mask(dev, val)) < 0)
+            return ret;
+        led_update_state(dev, val, 0, 1);
+        break;
+    case LED_IOC_GET_STATE:
+        val = dev->state;
+        if (put_user(val, (__u32 __user*)arg))
+            return -EFAULT;
+        break;
+    default:
+        return -ENOTTY;
     }
-    return 0;
+    return ret;
 }
 
 const struct file_operations led_ops = {
     .owner = THIS_MODULE,
     .open = led_open,
-    .release = led_release,
     .read = led_read,
     .write = led_write,
     .unlocked_ioctl = led_unlocked_ioctl,
 };
 
-led_dev_t* led_dev = NULL;
+static void led_deinit(led_t* led)
+{
+    led_classdev_deinit(led);
+    led_stop_pattern(led);
+    led_set_brightness(led, 0);
+    del_timer_sync(&led->pattern_timer);
+    hrtimer_cancel(&led->pwm_timer);
+    gpio_free(led->gpio);
+}
 
 int __init led_init(void)
 {
     int i = 0;
     int ret = 0;
     dev_t devno;
+    led_t* led = NULL;
+
+    if (pwm_freq == 0 || pwm_freq > LED_PWM_FREQ_MAX)
+        return -EINVAL;
+    for (i = 0; i < gpios_num; i++)
+    {
+        if (!gpio_is_valid(gpios[i]))
+        {
+            imx_err("led %d has no valid gpio.\n", i);
+            return -EINVAL;
+        }
+    }
 
     led_dev = kzalloc(sizeof(led_dev_t) * LED_DEV_MINORS, GFP_KERNEL);
-    
+    if (!led_dev)
+        return -ENOMEM;
+
+    mutex_init(&led_dev->ctl_lock);
+    led_dev->pwm_freq = pwm_freq;
+    led_dev->stats_stamp = ktime_get();
+
+    /* the pins are claimed for the lifetime of the module, not per open */
+    for (i = 0; i < gpios_num; i++)
+    {
+        led = led_dev->leds + i;
+        led->gpio = gpios[i];
+        led->index = i;
+        led->dev = led_dev;
+        spin_lock_init(&led->lock);
+        timer_setup(&led->pattern_timer, led_pattern_timer, 0);
+        hrtimer_setup(&led->pwm_timer, led_pwm_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+        if ((ret = gpio_request(led->gpio, "LED")) < 0)
+        {
+            imx_err("led %d gpio request failed.\n", i);
+            goto fail0;
+        }
+        gpio_direction_output(led->gpio, 0);
+        if ((ret = led_classdev_init(led)) < 0)
+        {
+            imx_err("led %d class register failed.\n", i);
+            gpio_free(led->gpio);
+            goto fail0;
+        }
+        led_dev->num++;
+    }
+
     if (led_dev_major)
     {
         devno = MKDEV(led_dev_major, 0);
-        register_chrdev_region(devno, LED_DEV_MINORS, LED_DEV_NAME);
+        ret = register_chrdev_region(devno, LED_DEV_MINORS, LED_DEV_NAME);
     }
     else
     {
-        alloc_chrdev_region(&devno, 0, LED_DEV_MINORS, LED_DEV_NAME);
+        ret = alloc_chrdev_region(&devno, 0, LED_DEV_MINORS, LED_DEV_NAME);
     }
+    if (ret < 0)
+        goto fail0;
 
     led_dev_major = MAJOR(devno);
 
@@ -104,12 +697,26 @@ int __init led_init(void)
         devno = MKDEV(led_dev_major, i);
         if ((ret = cdev_add(&led_dev[i].cdev, devno, 1)) != 0)
         {
-            printk("cdev_add failed\n");
-            return ret;
+            imx_err("cdev_add failed\n");
+            goto fail1;
         }
     }
 
+    imx_info("%u leds registered, major=%lu\n", led_dev->num, led_dev_major);
     return 0;
+fail1:
+    while (i--)
+    {
+        cdev_del(&led_dev[i].cdev);
+    }
+    unregister_chrdev_region(MKDEV(led_dev_major, 0), LED_DEV_MINORS);
+fail0:
+    while (led_dev->num)
+    {
+        led_deinit(led_dev->leds + --led_dev->num);
+    }
+    kfree(led_dev);
+    return ret;
 }
 
 void __exit led_exit(void)
@@ -120,12 +727,17 @@ void __exit led_exit(void)
     {
         cdev_del(&led_dev[i].cdev);
     }
+    for (i = 0; i < led_dev->num; i++)
+    {
+        led_deinit(led_dev->leds + i);
+    }
     dev_t devno = MKDEV(led_dev_major, 0);
     unregister_chrdev_region(devno, LED_DEV_MINORS);
+    kfree(led_dev);
 }
 
 module_init(led_init);
 module_exit(led_exit);
 
 MODULE_LICENSE("GPL");
-MODULE_AUTHOR("Arno");
\ No newline at end of file
+MODULE_AUTHOR("Arno");
@@ -0,0 +1,75 @@
+#ifndef __LED_IOCTL_H__
+#define __LED_IOCTL_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * ioctl interface of /dev/led, shared with userspace.
+ *
+ * The device drives a table of up to LED_MAX LEDs; LED n is bit n of every
+ * mask and state word. A write of a led_frame_t updates all LEDs in the mask
+ * at once, LED_IOC_TOGGLE inverts all LEDs in a mask and a read returns the
+ * cached on/off state as a __u32. The legacy int write and ioctl commands 0
+ * and 1 (off/on) act on LED 0. Any write, on/off or brightness command stops
+ * a pattern running on that LED.
+ */
+
+#define LED_MAX                     32
+#define LED_BRIGHTNESS_MAX          255
+
+typedef struct led_ioc_frame {
+    __u32 mask;                 /* LEDs to update */
+    __u32 value;                /* new on/off state of the LEDs in mask */
+} led_frame_t;
+
+typedef struct led_ioc_brightness {
+    __u32 index;
+    __u32 brightness;           /* 0 - LED_BRIGHTNESS_MAX */
+} led_brightness_t;
+
+typedef struct led_ioc_pwm_stats {
+    __u64 callbacks;            /* timer callbacks since load */
+    __u32 callbacks_per_sec;    /* since the previous LED_IOC_GET_PWM_STATS */
+    __u32 freq;                 /* PWM frequency in Hz, shared by all LEDs */
+    __u32 pwm_active;           /* mask of LEDs with a running PWM timer */
+    __u32 reserved;
+} led_pwm_stats_t;
+
+#define LED_PATTERN_STEPS_MAX       32
+
+/* A pattern is played from a kernel timer, step by step. */
+typedef struct led_ioc_pattern_step {
+    __u32 brightness;           /* 0 - LED_BRIGHTNESS_MAX */
+    __u32 duration_ms;
+} led_pattern_step_t;
+
+typedef struct led_ioc_pattern {
+    __u32 index;
+    __u32 steps_num;
+    __u32 repeat;               /* number of runs, 0 loops forever */
+    __u32 reserved;
+    led_pattern_step_t steps[LED_PATTERN_STEPS_MAX];
+} led_pattern_t;
+
+/*
+ * Actions other drivers can have the LEDs take directly in the kernel, see
+ * led_route.h. /dev/button bindings use them to give press feedback.
+ */
+#define LED_ACTION_NONE             0
+#define LED_ACTION_OFF              1
+#define LED_ACTION_ON               2
+#define LED_ACTION_TOGGLE           3
+#define LED_ACTION_PATTERN          4
+
+#define LED_IOC_MAGIC               'L'
+#define LED_IOC_SET_BRIGHTNESS      _IOW(LED_IOC_MAGIC, 1, led_brightness_t)
+#define LED_IOC_SET_PWM_FREQ        _IOW(LED_IOC_MAGIC, 2, __u32)
+#define LED_IOC_GET_PWM_STATS       _IOR(LED_IOC_MAGIC, 3, led_pwm_stats_t)
+#define LED_IOC_SET_PATTERN         _IOW(LED_IOC_MAGIC, 4, led_pattern_t)
+#define LED_IOC_STOP_PATTERN        _IOW(LED_IOC_MAGIC, 5, __u32)
+#define LED_IOC_SET_FRAME           _IOW(LED_IOC_MAGIC, 6, led_frame_t)
+#define LED_IOC_GET_STATE           _IOR(LED_IOC_MAGIC, 7, __u32)
+#define LED_IOC_TOGGLE              _IOW(LED_IOC_MAGIC, 8, __u32)
+
+#endif /* __LED_IOCTL_H__ */
@@ -0,0 +1,18 @@
+#ifndef __LED_ROUTE_H__
+#define __LED_ROUTE_H__
+
+#include "led_ioctl.h"
+
+/*
+ * In-kernel interface of led.ko for other drivers. Both calls are safe in
+ * any context, hard interrupts included. Callers that must not depend on
+ * led.ko being loaded take them with symbol_get().
+ *
+ * led_route() applies a LED_ACTION_* to every LED in mask; for
+ * LED_ACTION_PATTERN each of them plays pattern (its index is ignored).
+ * led_route_check() validates the same arguments without touching the LEDs.
+ */
+int led_route(u32 mask, unsigned int action, const led_pattern_t* pattern);
+int led_route_check(u32 mask, unsigned int action, const led_pattern_t* pattern);
+
+#endif /* __LED_ROUTE_H__ */
@@ -0,0 +1,57 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM imx_led
+
+#if !defined(__LED_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __LED_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(led_brightness,
+    TP_PROTO(unsigned int index, unsigned int brightness),
+    TP_ARGS(index, brightness),
+    TP_STRUCT__entry(
+        __field(unsigned int, index)
+        __field(unsigned int, brightness)
+    ),
+    TP_fast_assign(
+        __entry->index = index;
+        __entry->brightness = brightness;
+    ),
+    TP_printk("led=%u brightness=%u", __entry->index, __entry->brightness)
+);
+
+TRACE_EVENT(led_pwm_edge,
+    TP_PROTO(unsigned int index, int level),
+    TP_ARGS(index, level),
+    TP_STRUCT__entry(
+        __field(unsigned int, index)
+        __field(int, level)
+    ),
+    TP_fast_assign(
+        __entry->index = index;
+        __entry->level = level;
+    ),
+    TP_printk("led=%u level=%d", __entry->index, __entry->level)
+);
+
+TRACE_EVENT(led_state,
+    TP_PROTO(unsigned long old_state, unsigned long new_state),
+    TP_ARGS(old_state, new_state),
+    TP_STRUCT__entry(
+        __field(unsigned long, old_state)
+        __field(unsigned long, new_state)
+    ),
+    TP_fast_assign(
+        __entry->old_state = old_state;
+        __entry->new_state = new_state;
+    ),
+    TP_printk("state=0x%lx->0x%lx", __entry->old_state, __entry->new_state)
+);
+
+#endif /* __LED_TRACE_H__ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE led_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,134 @@
+/*
+ * Toggle-rate micro-benchmark for /dev/led.
+ *
+ * Each thread opens the device and inverts its own LED (thread n drives
+ * LED n % leds) with LED_IOC_TOGGLE, or with frame writes when -w is given,
+ * as fast as it can for the requested time.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../led_ioctl.h"
+
+
+#define BENCH_MAX_THREADS       64
+
+typedef struct {
+    pthread_t thread;
+    int fd;
+    unsigned int mask;
+    unsigned long long toggles;
+    int failed;
+} bench_thread_t;
+
+static volatile int running = 1;
+static int use_write = 0;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* bench_thread(void* arg)
+{
+    bench_thread_t* t = arg;
+    led_frame_t frame = {t->mask, 0};
+    unsigned int mask = t->mask;
+
+    while (running)
+    {
+        if (use_write)
+        {
+            frame.value ^= t->mask;
+            if (write(t->fd, &frame, sizeof(frame)) != sizeof(frame))
+                t->failed = 1;
+        }
+        else if (ioctl(t->fd, LED_IOC_TOGGLE, &mask) < 0)
+        {
+            t->failed = 1;
+        }
+        if (t->failed)
+            break;
+        t->toggles++;
+    }
+    return NULL;
+}
+
+int main(int argc, char* const argv[])
+{
+    bench_thread_t threads[BENCH_MAX_THREADS];
+    const char* path = "/dev/led";
+    unsigned long long total = 0;
+    int nthreads = 1;
+    int leds = 1;
+    int seconds = 5;
+    double start = 0, elapsed = 0;
+    int opt = 0, i = 0, ret = 0;
+
+    while ((opt = getopt(argc, argv, "d:t:l:s:w")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd': path = optarg; break;
+        case 't': nthreads = atoi(optarg); break;
+        case 'l': leds = atoi(optarg); break;
+        case 's': seconds = atoi(optarg); break;
+        case 'w': use_write = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-d dev] [-t threads] [-l leds] [-s seconds] [-w]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (nthreads <= 0 || nthreads > BENCH_MAX_THREADS || leds <= 0 || leds > LED_MAX || seconds <= 0)
+    {
+        fprintf(stderr, "bad arguments\n");
+        return 1;
+    }
+
+    for (i = 0; i < nthreads; i++)
+    {
+        threads[i].fd = open(path, O_RDWR);
+        if (threads[i].fd < 0)
+        {
+            perror("led open failed.");
+            return 1;
+        }
+        threads[i].mask = 1u << (i % leds);
+        threads[i].toggles = 0;
+        threads[i].failed = 0;
+    }
+
+    start = now_sec();
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_create(&threads[i].thread, NULL, bench_thread, threads + i);
+    }
+    sleep(seconds);
+    running = 0;
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        close(threads[i].fd);
+        total += threads[i].toggles;
+        ret |= threads[i].failed;
+    }
+    elapsed = now_sec() - start;
+
+    printf("led.toggle.method %s\n", use_write ? "write" : "ioctl");
+    printf("led.toggle.threads %d\n", nthreads);
+    printf("led.toggle.leds %d\n", leds);
+    printf("led.toggle.total %llu\n", total);
+    printf("led.toggle.per_sec %.0f\n", total / elapsed);
+    printf("led.toggle.per_sec_per_thread %.0f\n", total / elapsed / nthreads);
+    printf("led.toggle.errors %d\n", ret);
+
+    return ret;
+}
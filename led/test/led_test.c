@@ -4,10 +4,21 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <sys/ioctl.h>
+#include "../led_ioctl.h"
 
 
 int main(void)
 {
+    led_pwm_stats_t stats;
+    led_pattern_t pattern = {
+        .index = 0,
+        .steps_num = 2,
+        .repeat = 5,
+        .steps = {{LED_BRIGHTNESS_MAX, 100}, {0, 400}},
+    };
+    led_brightness_t brightness = {0, 0};
+    led_frame_t frame = {0, 0};
+    unsigned int state = 0;
     int level = 0;
     int fd = open("/dev/led", O_RDWR);
     if (fd < 0)
@@ -27,6 +38,33 @@ int main(void)
     ioctl(fd, 0);
     sleep(2);
     ioctl(fd, 1);
+    sleep(1);
+
+    printf("test pwm...\n");
+    ioctl(fd, LED_IOC_GET_PWM_STATS, &stats);
+    for (brightness.brightness = 0; brightness.brightness <= LED_BRIGHTNESS_MAX; brightness.brightness += 51)
+    {
+        ioctl(fd, LED_IOC_SET_BRIGHTNESS, &brightness);
+        sleep(1);
+        ioctl(fd, LED_IOC_GET_PWM_STATS, &stats);
+        printf("brightness %u: %u Hz, %u callbacks/s\n", brightness.brightness, stats.freq, stats.callbacks_per_sec);
+    }
+
+    printf("test frame...\n");
+    frame.mask = 0x1;
+    for (level = 0; level < 4; level++)
+    {
+        frame.value = level & 1;
+        write(fd, (const void*)&frame, sizeof(frame));
+        read(fd, &state, sizeof(state));
+        printf("frame value 0x%x: state 0x%x\n", frame.value, state);
+        sleep(1);
+    }
+
+    printf("test pattern...\n");
+    if (ioctl(fd, LED_IOC_SET_PATTERN, &pattern) < 0)
+        perror("set pattern failed.");
+    sleep(3);
     close(fd);
 
     return 0;